@@ -0,0 +1,1036 @@
+#include "benchmarks.hpp"
+
+#include <bit>
+#include <filesystem>
+#include <fstream>
+#include <omp.h>
+#include <queue>
+#include <random>
+
+#include "portal_visibility.hpp"
+#include "room_graph.hpp"
+#include "sector_visibility.hpp"
+
+int Benchmarks::run(std::vector<std::string> args)
+{
+    if (args.size() == 0)
+    {
+        std::cerr << "usage: portals --bench <mapgen|mapgen-parallel|mapgen-batch|grid|mapfile|scheme|pvs|pvs-cache|pvs-door|tile-pvs|sector-pvs|cones|pvs-split> [size] [seed]" << std::endl;
+        return 1;
+    }
+
+    unsigned size = args.size() > 1 ? std::stoul(args[1]) : 1000;
+    unsigned seed = args.size() > 2 ? std::stoul(args[2]) : (unsigned)time(0);
+
+    if (args[0] == "mapgen")
+        return mapGen(size, size, seed);
+
+    if (args[0] == "mapgen-parallel")
+        return mapGenParallel(size, size, seed);
+
+    if (args[0] == "mapgen-batch")
+        return mapGenBatch(size, size, seed);
+
+    if (args[0] == "grid")
+        return grid(size, size, seed);
+
+    if (args[0] == "mapfile")
+        return mapFile(size, size, seed);
+
+    if (args[0] == "scheme")
+        return scheme(size, size, seed);
+
+    if (args[0] == "pvs")
+        return pvs(size, size, seed);
+
+    if (args[0] == "pvs-cache")
+        return pvsCache(size, size, seed);
+
+    if (args[0] == "pvs-door")
+        return pvsDoor(size, size, seed);
+
+    if (args[0] == "tile-pvs")
+        return tilePvs(size, size, seed);
+
+    if (args[0] == "sector-pvs")
+        return sectorPvs(size, size, seed);
+
+    if (args[0] == "cones")
+        return cones(size, size, seed);
+
+    if (args[0] == "pvs-split")
+        return pvsSplit(size, size, seed);
+
+    std::cerr << "unknown benchmark " << args[0] << std::endl;
+    return 1;
+}
+
+double Benchmarks::secondsSince(std::chrono::steady_clock::time_point start)
+{
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+// FNV-1a over the tile grid, used to check that two generation paths agree
+unsigned long long Benchmarks::hashMap(MapGen& map)
+{
+    unsigned long long hash = 14695981039346656037ull;
+
+    for (unsigned i = 0; i < map.width * map.height; i++)
+    {
+        MapGen::Tile tile = map.getTileDirect(i);
+        hash = (hash ^ (unsigned)tile.roomId) * 1099511628211ull;
+        hash = (hash ^ tile.status) * 1099511628211ull;
+    }
+
+    return hash;
+}
+
+int Benchmarks::mapGen(unsigned width, unsigned height, unsigned seed)
+{
+    std::cout << "mapgen " << width << "x" << height << " seed " << seed << std::endl;
+
+    const MapGen::Placement placements[] = { MapGen::Placement::Grid, MapGen::Placement::Bitboard, MapGen::Placement::FeasibleTable };
+    const char* names[] = { "grid:     ", "bitboard: ", "feasible: " };
+
+    unsigned long long hashes[3];
+    double times[3];
+
+    for (unsigned i = 0; i < 3; i++)
+    {
+        MapGen map(width, height, seed);
+        map.placement = placements[i];
+
+        auto start = std::chrono::steady_clock::now();
+        map.generate();
+        times[i] = secondsSince(start);
+        hashes[i] = hashMap(map);
+
+        std::cout << "  " << names[i] << times[i] << " s, " << map.rooms.size() << " rooms, "
+            << (double)map.nPlacementTests / ((double)width * height) << " tests/tile" << std::endl;
+    }
+
+    // the feasible table samples differently, so only the first two produce the same map
+    std::cout << "  speedup:  bitboard " << times[0] / times[1] << "x, feasible " << times[0] / times[2] << "x" << std::endl;
+    std::cout << "  identical grid and bitboard maps: " << (hashes[0] == hashes[1] ? "yes" : "NO") << std::endl;
+
+    return hashes[0] == hashes[1] ? 0 : 1;
+}
+
+int Benchmarks::mapGenParallel(unsigned width, unsigned height, unsigned seed)
+{
+    std::cout << "mapgen-parallel " << width << "x" << height << " seed " << seed << std::endl;
+
+    double serialTime;
+    {
+        MapGen map(width, height, seed);
+
+        auto start = std::chrono::steady_clock::now();
+        map.generate();
+        serialTime = secondsSince(start);
+
+        std::cout << "  generate(): " << serialTime << " s, " << map.rooms.size() << " rooms" << std::endl;
+    }
+
+    std::cout << "  threads    time [s]   speedup    rooms      deterministic" << std::endl;
+
+    bool isDeterministic = true;
+    double singleThreadTime = 0.;
+
+    for (unsigned nThreads = 1; nThreads <= (unsigned)omp_get_max_threads(); nThreads *= 2)
+    {
+        unsigned long long hashes[2];
+        double time = 0.;
+        size_t nRooms = 0;
+
+        for (unsigned run = 0; run < 2; run++)
+        {
+            MapGen map(width, height, seed);
+
+            auto start = std::chrono::steady_clock::now();
+            map.generateParallel(nThreads);
+            time = run == 0 ? secondsSince(start) : min(time, secondsSince(start));
+
+            hashes[run] = hashMap(map);
+            nRooms = map.rooms.size();
+        }
+
+        if (nThreads == 1)
+            singleThreadTime = time;
+
+        isDeterministic &= hashes[0] == hashes[1];
+
+        std::cout << "  " << std::left << std::setw(11) << nThreads << std::setw(11) << time
+            << std::setw(11) << singleThreadTime / time << std::setw(11) << nRooms
+            << (hashes[0] == hashes[1] ? "yes" : "NO") << std::right << std::endl;
+    }
+
+    return isDeterministic ? 0 : 1;
+}
+
+int Benchmarks::mapGenBatch(unsigned width, unsigned height, unsigned seed)
+{
+    // enough maps to keep every thread busy for a while
+    const unsigned count = 64 * omp_get_max_threads();
+
+    std::cout << "mapgen-batch " << count << " maps " << width << "x" << height << " seeds from " << seed << std::endl;
+    std::cout << "  threads    time [s]   maps/s     speedup    deterministic" << std::endl;
+
+    // reference hashes from a single thread
+    vector<unsigned long long> hashes;
+    double singleThreadTime = 0.;
+    bool isDeterministic = true;
+
+    for (unsigned nThreads = 1; nThreads <= (unsigned)omp_get_max_threads(); nThreads *= 2)
+    {
+        auto start = std::chrono::steady_clock::now();
+        vector<MapGen> maps = MapGen::generateBatch(count, width, height, seed, nThreads);
+        double time = secondsSince(start);
+
+        if (nThreads == 1)
+            singleThreadTime = time;
+
+        bool isSame = true;
+        for (unsigned i = 0; i < count; i++)
+        {
+            assert(maps[i].seed == seed + i);
+
+            if (nThreads == 1)
+                hashes.push_back(hashMap(maps[i]));
+            else
+                isSame &= hashes[i] == hashMap(maps[i]);
+        }
+
+        isDeterministic &= isSame;
+
+        std::cout << "  " << std::left << std::setw(11) << nThreads << std::setw(11) << time
+            << std::setw(11) << count / time << std::setw(11) << singleThreadTime / time
+            << (isSame ? "yes" : "NO") << std::right << std::endl;
+    }
+
+    return isDeterministic ? 0 : 1;
+}
+
+// Memory taken by the tile grid and the time of the passes reading it
+int Benchmarks::grid(unsigned width, unsigned height, unsigned seed)
+{
+    std::cout << "grid " << width << "x" << height << " seed " << seed << std::endl;
+
+    MapGen map(width, height, seed);
+
+    auto start = std::chrono::steady_clock::now();
+    map.generate();
+    double generateTime = secondsSince(start);
+
+    size_t nTiles = (size_t)width * height;
+    std::cout << "  grid:         " << map.getGridBytes() / (1024. * 1024.) << " MiB, "
+        << (double)map.getGridBytes() / nTiles << " B/tile" << std::endl;
+    std::cout << "  generate:     " << generateTime << " s" << std::endl;
+
+    // the same tile walk as GLScene::addInstances
+    start = std::chrono::steady_clock::now();
+    size_t nWalls = 0;
+    size_t nDoors = 0;
+    for (unsigned y = 0; y < height; y++)
+    {
+        for (unsigned x = 0; x < width; x++)
+        {
+            MapGen::Tile tile = map.getTile(x, y);
+            if (!map.isTileInRoom(tile))
+                continue;
+
+            nWalls += std::popcount(tile.status & 0x0Fu);
+            nDoors += std::popcount(tile.status & 0xF0u);
+        }
+    }
+    std::cout << "  tile walk:    " << secondsSince(start) << " s, " << nWalls << " walls, " << nDoors << " doors" << std::endl;
+
+    start = std::chrono::steady_clock::now();
+    RoomGraph graph = RoomGraph::build(map);
+    std::cout << "  room graph:   " << secondsSince(start) << " s" << std::endl;
+
+    return 0;
+}
+
+// Saves a map, loads it back and checks that the loaded map is the same
+int Benchmarks::mapFile(unsigned width, unsigned height, unsigned seed)
+{
+    std::cout << "mapfile " << width << "x" << height << " seed " << seed << std::endl;
+
+    std::string path = (std::filesystem::temp_directory_path() / "portals_bench.map").string();
+
+    MapGen map(width, height, seed);
+    map.generate();
+
+    auto start = std::chrono::steady_clock::now();
+    if (!map.save(path))
+        return 1;
+    std::cout << "  save:         " << secondsSince(start) << " s, "
+        << std::filesystem::file_size(path) / (1024. * 1024.) << " MiB" << std::endl;
+
+    bool isSame;
+    {
+        MapGen loaded(0, 0);
+
+        start = std::chrono::steady_clock::now();
+        if (!loaded.load(path))
+            return 1;
+        std::cout << "  load:         " << secondsSince(start) << " s" << std::endl;
+
+        start = std::chrono::steady_clock::now();
+        isSame = hashMap(loaded) == hashMap(map) && loaded.getRoomCount() == map.getRoomCount();
+        std::cout << "  tile hash:    " << secondsSince(start) << " s" << std::endl;
+
+        for (unsigned i = 0; isSame && i < map.getRoomCount(); i++)
+        {
+            std::span<const Point> a = map.getRoomSegments(i);
+            std::span<const Point> b = loaded.getRoomSegments(i);
+
+            isSame = a.size() == b.size();
+            for (unsigned j = 0; isSame && j < a.size(); j++)
+                isSame = a[j].x == b[j].x && a[j].y == b[j].y;
+        }
+
+        start = std::chrono::steady_clock::now();
+        RoomGraph graph = RoomGraph::build(loaded);
+        std::cout << "  room graph:   " << secondsSince(start) << " s" << std::endl;
+    }
+
+    // a room id past the rooms has to be refused before the room graph indexes with it
+    bool isRefused;
+    {
+        std::fstream file(path, std::ios::binary | std::ios::in | std::ios::out);
+        MapFileHeader header;
+        file.read((char*)&header, sizeof(header));
+
+        int32_t roomId = (int32_t)header.nRooms;
+        file.seekp(header.roomIdsOffset);
+        file.write((const char*)&roomId, sizeof(roomId));
+        file.close();
+
+        MapGen corrupted(0, 0);
+        isRefused = !corrupted.load(path);
+    }
+
+    std::filesystem::remove(path);
+    std::cout << "  identical maps: " << (isSame ? "yes" : "NO") << std::endl;
+    std::cout << "  corrupted map refused: " << (isRefused ? "yes" : "NO") << std::endl;
+
+    return isSame && isRefused ? 0 : 1;
+}
+
+// Headless scheme export, rasterizing alone and written to a PPM file
+int Benchmarks::scheme(unsigned width, unsigned height, unsigned seed)
+{
+    std::cout << "scheme " << width << "x" << height << " seed " << seed << std::endl;
+
+    std::string path = (std::filesystem::temp_directory_path() / "portals_bench.ppm").string();
+
+    MapGen map(width, height, seed);
+    map.generateParallel(omp_get_max_threads());
+
+    for (unsigned tileSize : { 1u, 4u })
+    {
+        // the same bands as saveScheme
+        const unsigned bandRows = 64;
+        vector<uint8_t> pixels((size_t)width * tileSize * tileSize * min(height, bandRows) * 4);
+
+        auto start = std::chrono::steady_clock::now();
+        for (unsigned row = 0; row < height; row += bandRows)
+            map.rasterizeScheme(0, row, width, min(bandRows, height - row), tileSize, pixels.data());
+        double rasterTime = secondsSince(start);
+
+        start = std::chrono::steady_clock::now();
+        if (!map.saveScheme(path, tileSize))
+            return 1;
+        double saveTime = secondsSince(start);
+
+        double megaPixels = (double)width * height * tileSize * tileSize / 1e6;
+        std::cout << "  tile size " << tileSize << ": " << megaPixels << " Mpx, rasterize " << rasterTime << " s ("
+            << megaPixels / rasterTime << " Mpx/s), save " << saveTime << " s, "
+            << std::filesystem::file_size(path) / (1024. * 1024.) << " MiB" << std::endl;
+    }
+
+    std::filesystem::remove(path);
+
+    return 0;
+}
+
+// Cone tests and time of the visibility search with and without memoized cones. Without them
+// the search can take exponential time, so keep the maps small.
+int Benchmarks::pvs(unsigned width, unsigned height, unsigned seed)
+{
+    std::cout << "pvs " << width << "x" << height << " seed " << seed << std::endl;
+
+    MapGen map(width, height, seed);
+    map.generate();
+    RoomGraph graph = RoomGraph::build(map);
+
+    VisibilityMatrix visibilities[2];
+    double times[2];
+
+    for (unsigned memoize = 0; memoize < 2; memoize++)
+    {
+        PortalVisibility portal(&graph);
+        portal.memoizeCones = memoize;
+
+        auto start = std::chrono::steady_clock::now();
+        visibilities[memoize] = portal.getVisibilities();
+        times[memoize] = secondsSince(start);
+
+        std::cout << (memoize ? "  memoized:   " : "  unmemoized: ") << times[memoize] << " s, "
+            << portal.nConeTests << " cone tests, " << visibilities[memoize].getVisibleCount() << " visible rooms" << std::endl;
+    }
+
+    // a vector per room, as the visibilities were stored before
+    size_t vectorBytes = visibilities[1].getRoomCount() * sizeof(std::vector<unsigned>) + visibilities[1].getVisibleCount() * sizeof(unsigned);
+    // dense rows are quadratic in the room count, so they are not built here
+    size_t denseBytes = (size_t)visibilities[1].getRoomCount() * ((visibilities[1].getRoomCount() + 63) / 64) * sizeof(uint64_t);
+    std::cout << "  vector per room: " << vectorBytes / (1024. * 1024.) << " MiB, dense " << denseBytes / (1024. * 1024.) << " MiB" << std::endl;
+
+    const char* layoutNames[] = { "auto", "dense", "sparse", "compressed" };
+    VisibilityMatrix::Layout layouts[] = { VisibilityMatrix::Layout::Sparse, VisibilityMatrix::Layout::Compressed };
+    size_t sparseBytes = 0;
+    bool isSame = visibilities[0] == visibilities[1];
+
+    for (auto layout : layouts)
+    {
+        VisibilityMatrix matrix = visibilities[1].withLayout(layout);
+        isSame &= matrix == visibilities[1];
+
+        if (layout == VisibilityMatrix::Layout::Sparse)
+            sparseBytes = matrix.getBytes();
+
+        // decode every row into the same buffer, as the scene does on entering a room
+        std::vector<unsigned> row;
+        double maxDecodeTime = 0;
+
+        auto start = std::chrono::steady_clock::now();
+        for (unsigned roomId = 0; roomId < matrix.getRoomCount(); roomId++)
+        {
+            auto rowStart = std::chrono::steady_clock::now();
+            matrix.getRow(roomId, row);
+            maxDecodeTime = max(maxDecodeTime, secondsSince(rowStart));
+        }
+        double decodeTime = secondsSince(start);
+
+        std::cout << "  " << layoutNames[(int)layout] << ": " << matrix.getBytes() / (1024. * 1024.) << " MiB";
+        if (layout == VisibilityMatrix::Layout::Compressed)
+            std::cout << " (" << (double)sparseBytes / matrix.getBytes() << "x smaller than sparse)";
+        std::cout << ", row decode " << decodeTime / matrix.getRoomCount() * 1e6 << " us average, "
+            << maxDecodeTime * 1e6 << " us max" << std::endl;
+    }
+
+    std::cout << "  auto layout: " << layoutNames[(int)visibilities[1].getLayout()] << std::endl;
+    std::cout << "  speedup:    " << times[0] / times[1] << "x" << std::endl;
+    std::cout << "  identical visibilities: " << (isSame ? "yes" : "NO") << std::endl;
+
+    return isSame ? 0 : 1;
+}
+
+// Visibilities computed into an empty cache, loaded from it and recomputed after the file
+// is damaged
+int Benchmarks::pvsCache(unsigned width, unsigned height, unsigned seed)
+{
+    std::cout << "pvs-cache " << width << "x" << height << " seed " << seed << std::endl;
+
+    std::filesystem::path directory = std::filesystem::temp_directory_path() / "portals_bench_pvs";
+    std::filesystem::remove_all(directory);
+
+    MapGen map(width, height, seed);
+    map.generate();
+    RoomGraph graph = RoomGraph::build(map);
+    PortalVisibility portal(&graph);
+
+    auto start = std::chrono::steady_clock::now();
+    VisibilityMatrix computed = portal.getCachedVisibilities(map, directory.string());
+    std::cout << "  miss:      " << secondsSince(start) << " s" << std::endl;
+
+    std::filesystem::path path = std::filesystem::directory_iterator(directory)->path();
+    std::cout << "  file:      " << std::filesystem::file_size(path) / (1024. * 1024.) << " MiB" << std::endl;
+
+    start = std::chrono::steady_clock::now();
+    VisibilityMatrix loaded = portal.getCachedVisibilities(map, directory.string());
+    std::cout << "  hit:       " << secondsSince(start) << " s" << std::endl;
+
+    bool isSame = loaded == computed;
+
+    // flip a byte in the middle of the rows
+    {
+        std::fstream file(path, std::ios::binary | std::ios::in | std::ios::out);
+        uint64_t offset = std::filesystem::file_size(path) / 2;
+        char byte;
+        file.seekg(offset);
+        file.read(&byte, 1);
+        byte ^= 0x10;
+        file.seekp(offset);
+        file.write(&byte, 1);
+    }
+
+    start = std::chrono::steady_clock::now();
+    VisibilityMatrix recomputed = portal.getCachedVisibilities(map, directory.string());
+    std::cout << "  corrupted: " << secondsSince(start) << " s" << std::endl;
+
+    isSame &= recomputed == computed;
+
+    std::filesystem::remove_all(directory);
+    std::cout << "  identical visibilities: " << (isSame ? "yes" : "NO") << std::endl;
+
+    return isSame ? 0 : 1;
+}
+
+// Doors removed and added one at a time with the visibilities updated after each change,
+// checked against visibilities computed again for the final map
+int Benchmarks::pvsDoor(unsigned width, unsigned height, unsigned seed)
+{
+    std::cout << "pvs-door " << width << "x" << height << " seed " << seed << std::endl;
+
+    MapGen map(width, height, seed);
+    map.generate();
+    RoomGraph graph = RoomGraph::build(map);
+    PortalVisibility portal(&graph);
+
+    auto start = std::chrono::steady_clock::now();
+    VisibilityMatrix visibilities = portal.getVisibilities();
+    double fullTime = secondsSince(start);
+
+    std::mt19937 random(seed);
+    const unsigned nChanges = 16;
+    double totalTime = 0, maxTime = 0;
+    size_t nUpdatedRows = 0;
+
+    for (unsigned change = 0; change < nChanges; change++)
+    {
+        // even changes remove a door, odd ones add a door to a wall between two rooms
+        bool isRemoval = change % 2 == 0;
+
+        unsigned x, y, roomId, otherRoomId;
+        TileAttrib doorAttrib;
+
+        while (true)
+        {
+            x = random() % width;
+            y = random() % height;
+            doorAttrib = (TileAttrib)((unsigned)TileAttrib::DoorUp << (random() % 4));
+            glm::ivec2 other = glm::ivec2(x, y) + MapGen::otherTileOffsetFromDoorAttrib.at(doorAttrib);
+
+            if ((unsigned)other.x >= width || (unsigned)other.y >= height)
+                continue;
+
+            MapGen::Tile tile = map.getTile(x, y);
+            MapGen::Tile otherTile = map.getTile(other.x, other.y);
+
+            if (!map.isTileInRoom(tile) || !map.isTileInRoom(otherTile) || tile.roomId == otherTile.roomId
+                || map.hasTileAttrib(tile, doorAttrib) != isRemoval)
+                continue;
+
+            roomId = tile.roomId;
+            otherRoomId = otherTile.roomId;
+            break;
+        }
+
+        start = std::chrono::steady_clock::now();
+
+        if (isRemoval)
+            map.removeDoor(doorAttrib, x, y);
+        else
+            map.addDoor(doorAttrib, x, y);
+
+        graph.updateDoors(map, { roomId, otherRoomId });
+        nUpdatedRows += portal.updateVisibilities(visibilities, roomId, otherRoomId).size();
+
+        double time = secondsSince(start);
+        totalTime += time;
+        maxTime = max(maxTime, time);
+    }
+
+    std::cout << "  full:        " << fullTime << " s" << std::endl;
+    std::cout << "  incremental: " << totalTime / nChanges * 1e3 << " ms average, " << maxTime * 1e3 << " ms max, "
+        << (double)nUpdatedRows / nChanges << " rows per change" << std::endl;
+    std::cout << "  speedup:     " << fullTime / (totalTime / nChanges) << "x" << std::endl;
+
+    RoomGraph rebuiltGraph = RoomGraph::build(map);
+    PortalVisibility rebuiltPortal(&rebuiltGraph);
+    bool isSame = rebuiltGraph.getDoorCount() == graph.getDoorCount() && rebuiltPortal.getVisibilities() == visibilities;
+
+    std::cout << "  identical visibilities: " << (isSame ? "yes" : "NO") << std::endl;
+
+    return isSame ? 0 : 1;
+}
+
+// Cost of the visibilities of every tile against the room visibilities and the tiles drawn
+// from an average tile with either, every visible tile is drawn with its floor and walls
+int Benchmarks::tilePvs(unsigned width, unsigned height, unsigned seed)
+{
+    std::cout << "tile-pvs " << width << "x" << height << " seed " << seed << std::endl;
+
+    MapGen map(width, height, seed);
+    map.generate();
+    RoomGraph graph = RoomGraph::build(map);
+    PortalVisibility portal(&graph);
+
+    auto start = std::chrono::steady_clock::now();
+    VisibilityMatrix visibilities = portal.getVisibilities();
+    double roomTime = secondsSince(start);
+
+    start = std::chrono::steady_clock::now();
+    TileVisibility tileVisibilities = portal.getTileVisibilities(visibilities);
+    double tileTime = secondsSince(start);
+
+    std::vector<unsigned> roomRow;
+    std::vector<unsigned> tileRow;
+    unsigned long long nTiles = 0, nRoomDrawn = 0, nTileDrawn = 0;
+
+    start = std::chrono::steady_clock::now();
+    for (unsigned roomId = 0; roomId < graph.getRoomCount(); roomId++)
+    {
+        visibilities.getRow(roomId, roomRow);
+
+        unsigned nRoomTiles = 0;
+        for (unsigned visibleId : roomRow)
+            nRoomTiles += graph.getTiles(visibleId).size();
+
+        for (unsigned tileIndex = 0; tileIndex < graph.getTiles(roomId).size(); tileIndex++)
+        {
+            tileVisibilities.getRow(roomId, tileIndex, roomRow, tileRow);
+
+            for (unsigned visibleId : tileRow)
+                nTileDrawn += graph.getTiles(visibleId).size();
+
+            nRoomDrawn += nRoomTiles;
+            nTiles++;
+        }
+    }
+    double lookupTime = secondsSince(start);
+
+    std::cout << "  rooms: " << roomTime << " s, " << visibilities.getBytes() / 1048576. << " MiB" << std::endl;
+    std::cout << "  tiles: " << tileTime << " s, " << tileVisibilities.getBytes() / 1048576. << " MiB, "
+        << lookupTime / nTiles * 1e6 << " us per lookup" << std::endl;
+    std::cout << "  tiles drawn per tile: " << (double)nRoomDrawn / nTiles << " with rooms, " << (double)nTileDrawn / nTiles
+        << " with tiles (" << 100. * (1. - (double)nTileDrawn / nRoomDrawn) << "% fewer)" << std::endl;
+
+    // a door between two rooms is removed and the tiles of the changed rows are searched again
+    unsigned roomId = 0;
+    while (roomId < graph.getRoomCount() && graph.getDoors(roomId).empty())
+        roomId++;
+
+    if (roomId == graph.getRoomCount())
+        return 0;
+
+    RoomGraph::Door door = graph.getDoors(roomId)[0];
+    unsigned tileId = door.tileId;
+    map.removeDoor(door.doorType, tileId % width, tileId / width);
+
+    graph.updateDoors(map, { door.roomId, door.otherRoomId });
+    std::vector<unsigned> updatedRoomIds = portal.updateVisibilities(visibilities, door.roomId, door.otherRoomId);
+    portal.updateTileVisibilities(tileVisibilities, visibilities, updatedRoomIds);
+
+    TileVisibility rebuilt = portal.getTileVisibilities(visibilities);
+    std::vector<unsigned> rebuiltRow;
+    bool isSame = true;
+
+    for (unsigned roomId = 0; roomId < graph.getRoomCount() && isSame; roomId++)
+    {
+        visibilities.getRow(roomId, roomRow);
+
+        for (unsigned tileIndex = 0; tileIndex < graph.getTiles(roomId).size(); tileIndex++)
+        {
+            tileVisibilities.getRow(roomId, tileIndex, roomRow, tileRow);
+            rebuilt.getRow(roomId, tileIndex, roomRow, rebuiltRow);
+            isSame &= tileRow == rebuiltRow;
+        }
+    }
+
+    std::cout << "  identical tiles after a door change: " << (isSame ? "yes" : "NO") << std::endl;
+
+    return isSame ? 0 : 1;
+}
+
+// Sector visibilities searched around the map center as a walk would first need them, then
+// for the whole map, against the visibilities of all rooms at once
+int Benchmarks::sectorPvs(unsigned width, unsigned height, unsigned seed)
+{
+    std::cout << "sector-pvs " << width << "x" << height << " seed " << seed << std::endl;
+
+    MapGen map(width, height, seed);
+    map.generate();
+    RoomGraph graph = RoomGraph::build(map);
+
+    const unsigned sectorSide = 32;
+    const unsigned radius = 1;
+
+    auto start = std::chrono::steady_clock::now();
+    SectorVisibility sectorVisibilities(&graph, map, sectorSide);
+    double indexTime = secondsSince(start);
+    size_t indexBytes = sectorVisibilities.getBytes();
+
+    // the rooms of the sectors around the center see the sectors a camera there draws from
+    unsigned sectorsPerRow = (width + sectorSide - 1) / sectorSide;
+    unsigned sectorsPerColumn = (height + sectorSide - 1) / sectorSide;
+    glm::ivec2 center(sectorsPerRow / 2, sectorsPerColumn / 2);
+    std::vector<unsigned> row;
+
+    start = std::chrono::steady_clock::now();
+    for (int y = center.y - (int)radius; y <= center.y + (int)radius; y++)
+    {
+        for (int x = center.x - (int)radius; x <= center.x + (int)radius; x++)
+        {
+            if ((unsigned)x < sectorsPerRow && (unsigned)y < sectorsPerColumn)
+                sectorVisibilities.getVisibleSectors(y * sectorsPerRow + x);
+        }
+    }
+    double neighbourhoodTime = secondsSince(start);
+    size_t neighbourhoodBytes = sectorVisibilities.getBytes();
+    unsigned nNeighbourhoodSectors = sectorVisibilities.getSearchedSectorCount();
+
+    PortalVisibility portal(&graph);
+    start = std::chrono::steady_clock::now();
+    VisibilityMatrix visibilities = portal.getVisibilities();
+    double fullTime = secondsSince(start);
+
+    start = std::chrono::steady_clock::now();
+    for (unsigned roomId = 0; roomId < graph.getRoomCount(); roomId++)
+        sectorVisibilities.getRow(roomId, row);
+    double allSectorsTime = secondsSince(start);
+
+    std::vector<unsigned> matrixRow;
+    bool isSame = true;
+    uint64_t nVisibleSectors = 0;
+
+    for (unsigned roomId = 0; roomId < graph.getRoomCount() && isSame; roomId++)
+    {
+        sectorVisibilities.getRow(roomId, row);
+        visibilities.getRow(roomId, matrixRow);
+        isSame &= row == matrixRow;
+    }
+
+    for (unsigned sectorId = 0; sectorId < sectorVisibilities.getSectorCount(); sectorId++)
+        nVisibleSectors += sectorVisibilities.getVisibleSectors(sectorId).size();
+
+    // random pairs are mostly far apart, as most pairs of a large map are
+    std::mt19937 random(seed);
+    const unsigned nPairs = 1 << 20;
+    std::vector<std::pair<unsigned, unsigned>> pairs(nPairs);
+    for (auto& pair : pairs)
+        pair = { random() % graph.getRoomCount(), random() % graph.getRoomCount() };
+
+    unsigned nSectorVisible = 0, nMatrixVisible = 0;
+
+    start = std::chrono::steady_clock::now();
+    for (auto& pair : pairs)
+        nSectorVisible += sectorVisibilities.isVisible(pair.first, pair.second);
+    double sectorLookupTime = secondsSince(start);
+
+    start = std::chrono::steady_clock::now();
+    for (auto& pair : pairs)
+        nMatrixVisible += visibilities.isVisible(pair.first, pair.second);
+    double matrixLookupTime = secondsSince(start);
+
+    isSame &= nSectorVisible == nMatrixVisible;
+
+    std::cout << "  " << sectorVisibilities.getSectorCount() << " sectors of " << sectorSide << "x" << sectorSide << " tiles, "
+        << (double)nVisibleSectors / sectorVisibilities.getSectorCount() << " visible sectors per sector" << std::endl;
+    std::cout << "  rooms of the sectors: " << indexTime * 1e3 << " ms, " << indexBytes / 1048576. << " MiB" << std::endl;
+    std::cout << "  center " << nNeighbourhoodSectors << " sectors: " << neighbourhoodTime * 1e3 << " ms, "
+        << (neighbourhoodBytes - indexBytes) / 1048576. << " MiB" << std::endl;
+    std::cout << "  all sectors:  " << allSectorsTime << " s, " << (sectorVisibilities.getBytes() - indexBytes) / 1048576. << " MiB" << std::endl;
+    std::cout << "  all rooms:    " << fullTime << " s, " << visibilities.getBytes() / 1048576. << " MiB" << std::endl;
+    std::cout << "  isVisible:    " << sectorLookupTime / nPairs * 1e9 << " ns with sectors, "
+        << matrixLookupTime / nPairs * 1e9 << " ns with rooms" << std::endl;
+
+    // a door between two rooms is removed and the sectors seeing them are searched again
+    unsigned roomId = graph.getRoomCount() / 2;
+    while (roomId < graph.getRoomCount() && graph.getDoors(roomId).empty())
+        roomId++;
+
+    if (roomId < graph.getRoomCount())
+    {
+        RoomGraph::Door door = graph.getDoors(roomId)[0];
+        map.removeDoor(door.doorType, door.tileId % width, door.tileId / width);
+        graph.updateDoors(map, { door.roomId, door.otherRoomId });
+
+        unsigned nDropped = sectorVisibilities.invalidate(door.roomId, door.otherRoomId);
+        std::vector<unsigned> updatedRoomIds = portal.updateVisibilities(visibilities, door.roomId, door.otherRoomId);
+
+        for (unsigned roomId = 0; roomId < graph.getRoomCount() && isSame; roomId++)
+        {
+            sectorVisibilities.getRow(roomId, row);
+            visibilities.getRow(roomId, matrixRow);
+            isSame &= row == matrixRow;
+        }
+
+        std::cout << "  door removed: " << nDropped << " sectors dropped, " << updatedRoomIds.size() << " room rows updated" << std::endl;
+    }
+
+    std::cout << "  identical visibilities: " << (isSame ? "yes" : "NO") << std::endl;
+
+    return isSame ? 0 : 1;
+}
+
+// Cone tests per second one door at a time and batched over the doors of a room. The cones
+// are the first cones of the visibility search, from every door through the neighbouring
+// room, tested against the doors of the room behind it.
+int Benchmarks::cones(unsigned width, unsigned height, unsigned seed)
+{
+    std::cout << "cones " << width << "x" << height << " seed " << seed << std::endl;
+
+    MapGen map(width, height, seed);
+    map.generate();
+    RoomGraph graph = RoomGraph::build(map);
+    PortalVisibility portal(&graph);
+
+    using Door = RoomGraph::Door;
+
+    vector<PortalVisibility::ViewConeOrTunnel> cones;
+    vector<unsigned> coneRoomIds;
+
+    for (unsigned roomId = 0; roomId < graph.getRoomCount(); roomId++)
+    {
+        for (const Door& door : graph.getDoors(roomId))
+        {
+            for (const Door& neighborDoor : graph.getDoors(door.otherRoomId))
+            {
+                if (neighborDoor.otherRoomId == roomId || portal.areDoorsInSamePlane(door, neighborDoor))
+                    continue;
+
+                cones.push_back(portal.getViewConeOrTunnel(door.locations[0], door.locations[1], neighborDoor.locations[0], neighborDoor.locations[1], false));
+                coneRoomIds.push_back(neighborDoor.otherRoomId);
+            }
+        }
+    }
+
+    size_t nTests = 0;
+    for (unsigned roomId : coneRoomIds)
+        nTests += graph.getDoors(roomId).size();
+
+    vector<uint64_t> scalarMasks(cones.size()), batchedMasks(cones.size());
+
+    auto start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < cones.size(); i++)
+    {
+        std::span<const Door> doors = graph.getDoors(coneRoomIds[i]);
+        for (unsigned j = 0; j < doors.size() && j < 64; j++)
+        {
+            std::vector<glm::vec2> line = { doors[j].locations[0], doors[j].locations[1] };
+            scalarMasks[i] |= (uint64_t)portal.isLineInCone(cones[i], line) << j;
+        }
+    }
+    double scalarTime = secondsSince(start);
+
+    start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < cones.size(); i++)
+        batchedMasks[i] = portal.getDoorsInCone(cones[i], graph.getDoorArrays(coneRoomIds[i]), 0);
+    double batchedTime = secondsSince(start);
+
+    bool isSame = scalarMasks == batchedMasks;
+
+    std::cout << "  " << cones.size() << " cones, " << nTests << " cone tests" << std::endl;
+    std::cout << "  one at a time: " << nTests / scalarTime / 1e6 << " M tests/s" << std::endl;
+    std::cout << "  batched:       " << nTests / batchedTime / 1e6 << " M tests/s ("
+        << scalarTime / batchedTime << "x)" << std::endl;
+
+    // the whole search with both kinds of tests
+    VisibilityMatrix visibilities[2];
+    for (unsigned batched = 0; batched < 2; batched++)
+    {
+        portal.useBatchedTests = batched;
+
+        start = std::chrono::steady_clock::now();
+        visibilities[batched] = portal.getVisibilities();
+        std::cout << (batched ? "  batched search:       " : "  one at a time search: ") << secondsSince(start) << " s" << std::endl;
+    }
+
+    isSame &= visibilities[0] == visibilities[1];
+    std::cout << "  identical results: " << (isSame ? "yes" : "NO") << std::endl;
+
+    return isSame ? 0 : 1;
+}
+
+// Visibilities searched in blocks of rooms, and with the long searches split into tasks, on
+// the map and after a gallery of doors is opened along a row through its middle. The rooms of
+// the gallery see along all of it and lie in a few blocks, as the rooms of a long hall would.
+//
+// The tasks are also replayed one after another on one thread and their costs scheduled on
+// more threads than the machine may have, each idle thread taking the newest ready task. The
+// tail is the time the last thread runs after the work would have been evenly spread.
+int Benchmarks::pvsSplit(unsigned width, unsigned height, unsigned seed)
+{
+    std::cout << "pvs-split " << width << "x" << height << " seed " << seed << std::endl;
+
+    MapGen map(width, height, seed);
+    map.generate();
+
+    const unsigned galleryLength = min(width - 1, 512u);
+    const unsigned galleryRows = 16;
+    bool isSame = true;
+
+    for (unsigned hasGallery = 0; hasGallery < 2; hasGallery++)
+    {
+        unsigned nGalleryDoors = 0;
+        if (hasGallery)
+        {
+            for (unsigned y = height / 2; y < height / 2 + galleryRows; y++)
+            {
+                for (unsigned x = (width - galleryLength) / 2; x < (width + galleryLength) / 2; x++)
+                {
+                    nGalleryDoors += map.addDoor(TileAttrib::DoorRight, x, y);
+                    if (y + 1 < height / 2 + galleryRows)
+                        nGalleryDoors += map.addDoor(TileAttrib::DoorDown, x, y);
+                }
+            }
+
+            std::cout << "  gallery of " << galleryLength << " tiles, " << nGalleryDoors << " doors opened" << std::endl;
+        }
+
+        RoomGraph graph = RoomGraph::build(map);
+        VisibilityMatrix visibilities[2];
+        std::vector<ReplayedTask> tasks[2];
+
+        for (unsigned split = 0; split < 2; split++)
+        {
+            PortalVisibility portal(&graph);
+            portal.splitSearches = split;
+
+            auto start = std::chrono::steady_clock::now();
+            visibilities[split] = portal.getVisibilities();
+            double time = secondsSince(start);
+
+            std::cout << (split ? "  split:  " : "  blocks: ") << time << " s on " << omp_get_max_threads() << " threads, "
+                << portal.nConeTests << " cone tests, " << visibilities[split].getVisibleCount() << " visible rooms" << std::endl;
+
+            tasks[split] = replaySearchTasks(portal, split);
+        }
+
+        for (unsigned split = 0; split < 2; split++)
+        {
+            double total = 0, longest = 0;
+            for (const ReplayedTask& task : tasks[split])
+            {
+                total += task.seconds;
+                longest = max(longest, task.seconds);
+            }
+
+            std::cout << (split ? "  split:  " : "  blocks: ") << tasks[split].size() << " tasks, longest "
+                << longest * 1e3 << " ms of " << total << " s" << std::endl;
+
+            for (unsigned nThreads = 8; nThreads <= 128; nThreads *= 2)
+            {
+                double makespan = getMakespan(tasks[split], nThreads);
+                std::cout << "    " << std::setw(3) << nThreads << " threads: " << makespan * 1e3 << " ms, tail "
+                    << (makespan - total / nThreads) * 1e3 << " ms" << std::endl;
+            }
+        }
+
+        isSame &= visibilities[0] == visibilities[1];
+    }
+
+    std::cout << "  identical visibilities: " << (isSame ? "yes" : "NO") << std::endl;
+
+    return isSame ? 0 : 1;
+}
+
+// The tasks of getVisibilities one after another, children after their parent
+std::vector<Benchmarks::ReplayedTask> Benchmarks::replaySearchTasks(PortalVisibility& portal, bool splitSearches)
+{
+    const RoomGraph& graph = *portal.graph;
+    PortalVisibility::SearchThread thread(graph.getRoomCount(), graph.getDoorCount());
+
+    std::vector<ReplayedTask> tasks;
+    // steps of every task waiting to be replayed, with the task they would be made by
+    std::vector<std::pair<std::vector<PortalVisibility::SplitStep>, unsigned>> splitTasks;
+    std::vector<PortalVisibility::SplitStep> splitSteps;
+
+    for (unsigned first = 0; first < graph.getRoomCount(); first += VISIBILITY_BLOCK_ROOMS)
+    {
+        auto start = std::chrono::steady_clock::now();
+        unsigned long long splitConeTests = thread.nConeTests + VISIBILITY_SPLIT_CONE_TESTS;
+
+        for (unsigned roomId = first; roomId < min(first + VISIBILITY_BLOCK_ROOMS, graph.getRoomCount()); roomId++)
+        {
+            portal.addVisibleRooms(roomId, thread.visibleRooms, thread.searchedDoors, thread.nConeTests, {}, splitSearches ? &splitSteps : nullptr, splitConeTests);
+            thread.visibleRooms.clear();
+        }
+
+        if (!splitSteps.empty())
+            splitTasks.push_back({ splitSteps, (unsigned)tasks.size() });
+
+        splitSteps.clear();
+        tasks.push_back({ secondsSince(start), -1, 0 });
+    }
+
+    // children are made at the end of their parent
+    for (size_t i = 0; i < splitTasks.size(); i++)
+    {
+        std::vector<PortalVisibility::SplitStep> steps = splitTasks[i].first;
+
+        auto start = std::chrono::steady_clock::now();
+        size_t nSearched = portal.searchSteps(thread, steps);
+        double seconds = secondsSince(start);
+
+        if (nSearched < steps.size())
+        {
+            size_t middle = nSearched + (steps.size() - nSearched + 1) / 2;
+            splitTasks.push_back({ { steps.begin() + nSearched, steps.begin() + middle }, (unsigned)tasks.size() });
+
+            if (middle < steps.size())
+                splitTasks.push_back({ { steps.begin() + middle, steps.end() }, (unsigned)tasks.size() });
+        }
+
+        thread.splitIds.clear();
+        unsigned parent = splitTasks[i].second;
+        tasks.push_back({ seconds, (int)parent, tasks[parent].seconds });
+    }
+
+    return tasks;
+}
+
+// Tasks without a parent are ready at once, in order
+double Benchmarks::getMakespan(const std::vector<ReplayedTask>& tasks, unsigned nThreads)
+{
+    std::vector<std::vector<unsigned>> children(tasks.size());
+    std::vector<unsigned> ready;
+
+    for (unsigned i = (unsigned)tasks.size(); i-- > 0;)
+    {
+        if (tasks[i].parent < 0)
+            ready.push_back(i);
+        else
+            children[tasks[i].parent].push_back(i);
+    }
+
+    // threads by the time they are free, tasks by the time they become ready
+    using Event = std::pair<double, unsigned>;
+    std::priority_queue<double, std::vector<double>, std::greater<double>> threads;
+    std::priority_queue<Event, std::vector<Event>, std::greater<Event>> waiting;
+
+    for (unsigned i = 0; i < nThreads; i++)
+        threads.push(0);
+
+    double makespan = 0;
+
+    while (!ready.empty() || !waiting.empty())
+    {
+        double time = threads.top();
+        threads.pop();
+
+        if (ready.empty() || (!waiting.empty() && waiting.top().first <= time))
+        {
+            time = max(time, waiting.top().first);
+            while (!waiting.empty() && waiting.top().first <= time)
+            {
+                ready.push_back(waiting.top().second);
+                waiting.pop();
+            }
+        }
+
+        unsigned taskId = ready.back();
+        ready.pop_back();
+
+        for (unsigned child : children[taskId])
+            waiting.push({ time + tasks[child].readyOffset, child });
+
+        threads.push(time + tasks[taskId].seconds);
+        makespan = max(makespan, time + tasks[taskId].seconds);
+    }
+
+    return makespan;
+}
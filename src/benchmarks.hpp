@@ -0,0 +1,47 @@
+#pragma once
+
+#include <iostream>
+#include <iomanip>
+#include <string>
+#include <vector>
+#include <chrono>
+
+#include "map_gen.hpp"
+
+class PortalVisibility;
+
+// Command line benchmarks, run as `portals --bench <name> [args]`
+class Benchmarks
+{
+public:
+    static int run(std::vector<std::string> args);
+
+private:
+    static double secondsSince(std::chrono::steady_clock::time_point start);
+    static unsigned long long hashMap(MapGen& map);
+
+    static int mapGen(unsigned width, unsigned height, unsigned seed);
+    static int mapGenParallel(unsigned width, unsigned height, unsigned seed);
+    static int mapGenBatch(unsigned width, unsigned height, unsigned seed);
+    static int grid(unsigned width, unsigned height, unsigned seed);
+    static int mapFile(unsigned width, unsigned height, unsigned seed);
+    static int scheme(unsigned width, unsigned height, unsigned seed);
+    static int pvs(unsigned width, unsigned height, unsigned seed);
+    static int pvsCache(unsigned width, unsigned height, unsigned seed);
+    static int pvsDoor(unsigned width, unsigned height, unsigned seed);
+    static int tilePvs(unsigned width, unsigned height, unsigned seed);
+    static int sectorPvs(unsigned width, unsigned height, unsigned seed);
+    static int cones(unsigned width, unsigned height, unsigned seed);
+    static int pvsSplit(unsigned width, unsigned height, unsigned seed);
+
+    // Task of a replayed search, ready readyOffset seconds after its parent task started
+    struct ReplayedTask
+    {
+        double seconds;
+        int parent;
+        double readyOffset;
+    };
+
+    static std::vector<ReplayedTask> replaySearchTasks(PortalVisibility& portal, bool splitSearches);
+    static double getMakespan(const std::vector<ReplayedTask>& tasks, unsigned nThreads);
+};
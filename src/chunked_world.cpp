@@ -0,0 +1,150 @@
+#include "chunked_world.hpp"
+#include "portal_visibility.hpp"
+
+ChunkedWorld::ChunkedWorld(unsigned seed, unsigned chunkSize, unsigned radius) :
+    window(0, 0)
+{
+    this->seed = seed;
+    this->chunkSize = chunkSize;
+    this->radius = radius;
+}
+
+// splitmix64 finalizer
+uint64_t ChunkedWorld::hash(uint64_t value)
+{
+    value += 0x9e3779b97f4a7c15ull;
+    value = (value ^ (value >> 30)) * 0xbf58476d1ce4e5b9ull;
+    value = (value ^ (value >> 27)) * 0x94d049bb133111ebull;
+    return value ^ (value >> 31);
+}
+
+MapGen ChunkedWorld::generateChunk(unsigned seed, glm::ivec2 chunk, unsigned chunkSize)
+{
+    uint64_t chunkSeed = hash(hash(hash(seed) ^ (uint32_t)chunk.x) ^ (uint32_t)chunk.y);
+
+    MapGen map(chunkSize, chunkSize, (unsigned)chunkSeed);
+    map.generate();
+
+    return map;
+}
+
+MapGen& ChunkedWorld::getChunk(glm::ivec2 chunk)
+{
+    auto key = std::make_pair(chunk.x, chunk.y);
+
+    auto it = chunks.find(key);
+    if (it == chunks.end())
+        it = chunks.emplace(key, generateChunk(seed, chunk, chunkSize)).first;
+
+    return it->second;
+}
+
+void ChunkedWorld::evictChunks()
+{
+    for (auto it = chunks.begin(); it != chunks.end();)
+    {
+        int distance = max(abs(it->first.first - centerChunk.x), abs(it->first.second - centerChunk.y));
+
+        if (distance > (int)radius + 1)
+            it = chunks.erase(it);
+        else
+            it++;
+    }
+}
+
+glm::ivec2 ChunkedWorld::getWindowOrigin()
+{
+    return (centerChunk - glm::ivec2(radius)) * (int)chunkSize;
+}
+
+unsigned ChunkedWorld::getWindowSize()
+{
+    return (2 * radius + 1) * chunkSize;
+}
+
+unsigned ChunkedWorld::getResidentChunks()
+{
+    return chunks.size();
+}
+
+// One door for every run of tile pairs along a chunk border which join the same two rooms,
+// placed by a hash of the run's global position
+void ChunkedWorld::addBorderDoors(unsigned borderX, unsigned borderY, bool isVertical)
+{
+    TileAttrib doorAttrib = isVertical ? TileAttrib::DoorRight : TileAttrib::DoorDown;
+    glm::ivec2 origin = getWindowOrigin();
+
+    unsigned runStart = 0;
+    for (unsigned i = 0; i <= chunkSize; i++)
+    {
+        unsigned x = isVertical ? borderX - 1 : borderX + i;
+        unsigned y = isVertical ? borderY + i : borderY - 1;
+        unsigned runX = isVertical ? borderX - 1 : borderX + runStart;
+        unsigned runY = isVertical ? borderY + runStart : borderY - 1;
+
+        bool isRunOver = i == chunkSize;
+        if (!isRunOver)
+        {
+            MapGen::Tile tile = window.getTile(x, y);
+            MapGen::Tile runTile = window.getTile(runX, runY);
+            MapGen::Tile other = isVertical ? window.getTile(x + 1, y) : window.getTile(x, y + 1);
+            MapGen::Tile runOther = isVertical ? window.getTile(runX + 1, runY) : window.getTile(runX, runY + 1);
+
+            isRunOver = tile.roomId != runTile.roomId || other.roomId != runOther.roomId;
+        }
+
+        if (!isRunOver)
+            continue;
+
+        uint64_t runHash = hash(hash(hash(seed ^ ((uint64_t)isVertical << 32)) ^ (uint32_t)(origin.x + runX)) ^ (uint32_t)(origin.y + runY));
+        unsigned doorOffset = runHash % (i - runStart);
+
+        if (isVertical)
+            window.addDoor(doorAttrib, runX, runY + doorOffset);
+        else
+            window.addDoor(doorAttrib, runX + doorOffset, runY);
+
+        runStart = i;
+    }
+}
+
+bool ChunkedWorld::setCenter(glm::ivec2 chunk)
+{
+    if (hasWindow && chunk == centerChunk)
+        return false;
+
+    centerChunk = chunk;
+    hasWindow = true;
+
+    unsigned nChunks = 2 * radius + 1;
+    window = MapGen(getWindowSize(), getWindowSize(), seed);
+
+    for (unsigned y = 0; y < nChunks; y++)
+    {
+        for (unsigned x = 0; x < nChunks; x++)
+        {
+            glm::ivec2 offset = glm::ivec2(x, y) - glm::ivec2(radius);
+            window.paste(getChunk(centerChunk + offset), x * chunkSize, y * chunkSize);
+        }
+    }
+
+    for (unsigned y = 0; y < nChunks; y++)
+    {
+        for (unsigned x = 0; x < nChunks; x++)
+        {
+            if (x > 0)
+                addBorderDoors(x * chunkSize, y * chunkSize, true);
+
+            if (y > 0)
+                addBorderDoors(x * chunkSize, y * chunkSize, false);
+        }
+    }
+
+    evictChunks();
+
+    graph = RoomGraph::build(window);
+    PortalVisibility portal(&graph);
+    visibilities = portal.getVisibilities();
+
+    return true;
+}
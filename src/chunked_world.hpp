@@ -0,0 +1,52 @@
+#pragma once
+
+#include <map>
+#include <utility>
+#include <vector>
+
+#include "glm/glm.hpp"
+
+#include "map_gen.hpp"
+#include "room_graph.hpp"
+#include "visibility_matrix.hpp"
+
+// Endless map made of square chunks. A chunk is a MapGen seeded from (seed, chunk coords),
+// so it is the same every time it is generated. Chunks around the center are pasted into
+// one window map, the doors between them are a function of both chunks, so neighbouring
+// chunks always agree on them.
+class ChunkedWorld
+{
+public:
+    ChunkedWorld(unsigned seed, unsigned chunkSize, unsigned radius);
+
+    unsigned seed;
+    unsigned chunkSize;
+    unsigned radius;
+
+    // (2 * radius + 1)^2 chunks around centerChunk
+    MapGen window;
+    RoomGraph graph;
+    VisibilityMatrix visibilities;
+    glm::ivec2 centerChunk{ 0, 0 };
+
+    // Rebuilds the window and its visibilities around the chunk, returns false if it already was the center
+    bool setCenter(glm::ivec2 chunk);
+    // Global tile coordinates of the top left window tile
+    glm::ivec2 getWindowOrigin();
+    unsigned getWindowSize();
+    unsigned getResidentChunks();
+
+    static MapGen generateChunk(unsigned seed, glm::ivec2 chunk, unsigned chunkSize);
+
+private:
+    bool hasWindow = false;
+
+    // generated chunks, the ones further than radius + 1 from the center are evicted
+    std::map<std::pair<int, int>, MapGen> chunks;
+
+    static uint64_t hash(uint64_t value);
+
+    MapGen& getChunk(glm::ivec2 chunk);
+    void evictChunks();
+    void addBorderDoors(unsigned borderX, unsigned borderY, bool isVertical);
+};
@@ -1,5 +1,26 @@
 #include "map_gen.hpp"
 
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+
+// tile rows rasterized and written at a time by saveScheme, bounds its memory
+#define SCHEME_BAND_ROWS 64
+
+// tiles along a side of a chunk of the scheme window
+#define SCHEME_CHUNK_TILES 64
+// window units per tile from which chunks are drawn as batches of lines, closer to the
+// whole map they are drawn as images
+#define SCHEME_MIN_BATCH_ZOOM 8.
+// below this zoom chunk images have one pixel per tile instead of four
+#define SCHEME_MIN_DETAIL_ZOOM 2.
+#define SCHEME_MAX_ZOOM 128.
+// zoom factor of one mouse wheel step
+#define SCHEME_ZOOM_STEP 1.25
+// window units panned per frame by the keys
+#define SCHEME_PAN_STEP 10.
+
 void MapGen::drawInit(double width)
 {
     this->windowWidth = width;
@@ -8,30 +29,18 @@ void MapGen::drawInit(double width)
     cg::create_window("MapGen", windowWidth, windowHeight);
     cg::set_inactive_color(.1, .1, .1);
 
-    cg::set_color(drawColors.defaultGrid);
-    for (int i = 0; i < this->width + 1; i++)
-    {
-        cg::line((windowWidth / this->width) * i, 0, (windowWidth / this->width) * i, windowHeight);
-        cg::line((windowWidth / this->width) * i + 1, 0, (windowWidth / this->width) * i + 1, windowHeight);
-    }
-
-    for (int i = 0; i < this->height + 1; i++)
-    {
-        cg::line(0, (windowHeight / this->height) * i, windowWidth - 1, (windowHeight / this->height) * i);
-        cg::line(0, (windowHeight / this->height) * i + 1, windowWidth - 1, (windowHeight / this->height) * i + 1);
-    }
+    cg::set_fps(60);
+    cg::set_steps_per_second(60);
 }
 
-void MapGen::drawTile(unsigned x, unsigned y)
+void MapGen::drawTile(unsigned x, unsigned y, double x1, double y1, double tileSize)
 {
-    Tile& tile = getTile(x, y);
+    Tile tile = getTile(x, y);
     if (!isTileInRoom(tile))
         return;
 
-    double tileWidth = windowWidth / width;
-    double tileHeight = windowHeight / height;
-    double x1 = x * tileWidth;
-    double y1 = y * tileHeight;
+    double tileWidth = tileSize;
+    double tileHeight = tileSize;
 
     cg::set_color(drawColors.floor);
     cg::set_fill_color(drawColors.floor);
@@ -80,17 +89,318 @@ void MapGen::drawTile(unsigned x, unsigned y)
     }
 }
 
+// Shows the map in chunks of SCHEME_CHUNK_TILES. Only chunks in the view are drawn and each
+// is built once, batches again when the zoom changes. The mouse wheel zooms, the left mouse
+// button or the arrow keys pan.
 void MapGen::drawScheme(double width)
 {
     drawInit(width);
 
-    for (unsigned y = 0; y < height; y++)
+    unsigned nChunksX = (this->width + SCHEME_CHUNK_TILES - 1) / SCHEME_CHUNK_TILES;
+    unsigned nChunksY = (height + SCHEME_CHUNK_TILES - 1) / SCHEME_CHUNK_TILES;
+    vector<SchemeChunk> chunks(nChunksX * nChunksY);
+    SchemePixels pixels;
+    vector<unsigned> visibleChunks;
+
+    // tile at the top left corner of the window and window units per tile
+    double viewX = 0.;
+    double viewY = 0.;
+    double zoom = windowWidth / this->width;
+    double minZoom = zoom / 2.;
+
+    double mouseX = cg::get_mouse_x();
+    double mouseY = cg::get_mouse_y();
+    double wheel = cg::get_mousewheel_pos();
+    bool isViewChanged = true;
+
+    while (cg::refresh())
+    {
+        double newMouseX = cg::get_mouse_x();
+        double newMouseY = cg::get_mouse_y();
+        double newWheel = cg::get_mousewheel_pos();
+
+        if (newWheel != wheel)
+        {
+            // keep the tile under the mouse in place
+            double newZoom = std::clamp(zoom * std::pow(SCHEME_ZOOM_STEP, newWheel - wheel), minZoom, SCHEME_MAX_ZOOM);
+            viewX += newMouseX / zoom - newMouseX / newZoom;
+            viewY += newMouseY / zoom - newMouseY / newZoom;
+            zoom = newZoom;
+            isViewChanged = true;
+        }
+
+        if (cg::is_input(cg::MouseLeft) && (newMouseX != mouseX || newMouseY != mouseY))
+        {
+            viewX -= (newMouseX - mouseX) / zoom;
+            viewY -= (newMouseY - mouseY) / zoom;
+            isViewChanged = true;
+        }
+
+        double panStep = SCHEME_PAN_STEP / zoom;
+        int panX = cg::is_input(cg::KeyRight) - cg::is_input(cg::KeyLeft);
+        int panY = cg::is_input(cg::KeyDown) - cg::is_input(cg::KeyUp);
+        if (panX != 0 || panY != 0)
+        {
+            viewX += panX * panStep;
+            viewY += panY * panStep;
+            isViewChanged = true;
+        }
+
+        mouseX = newMouseX;
+        mouseY = newMouseY;
+        wheel = newWheel;
+
+        if (!isViewChanged)
+            continue;
+
+        isViewChanged = false;
+
+        int firstChunkX = std::max((int)std::floor(viewX / SCHEME_CHUNK_TILES), 0);
+        int firstChunkY = std::max((int)std::floor(viewY / SCHEME_CHUNK_TILES), 0);
+        int lastChunkX = std::min((int)std::floor((viewX + windowWidth / zoom) / SCHEME_CHUNK_TILES), (int)nChunksX - 1);
+        int lastChunkY = std::min((int)std::floor((viewY + windowHeight / zoom) / SCHEME_CHUNK_TILES), (int)nChunksY - 1);
+
+        // chunks which left the view give up their batches and images
+        for (unsigned chunkId : visibleChunks)
+        {
+            int chunkX = chunkId % nChunksX;
+            int chunkY = chunkId / nChunksX;
+
+            if (chunkX < firstChunkX || chunkX > lastChunkX || chunkY < firstChunkY || chunkY > lastChunkY)
+                releaseSchemeChunk(chunkId, chunks[chunkId], pixels);
+        }
+
+        visibleChunks.clear();
+        cg::clear();
+
+        for (int chunkY = firstChunkY; chunkY <= lastChunkY; chunkY++)
+        {
+            for (int chunkX = firstChunkX; chunkX <= lastChunkX; chunkX++)
+            {
+                unsigned chunkId = chunkY * nChunksX + chunkX;
+                visibleChunks.push_back(chunkId);
+
+                double left = (chunkX * SCHEME_CHUNK_TILES - viewX) * zoom;
+                double top = (chunkY * SCHEME_CHUNK_TILES - viewY) * zoom;
+                drawSchemeChunk(chunkId, chunks[chunkId], pixels, zoom, left, top);
+            }
+        }
+    }
+}
+
+static std::string getSchemeBatchName(unsigned chunkId)
+{
+    return "scheme " + std::to_string(chunkId);
+}
+
+void MapGen::drawSchemeChunk(unsigned chunkId, SchemeChunk& chunk, SchemePixels& pixels, double zoom, double left, double top)
+{
+    unsigned nChunksX = (width + SCHEME_CHUNK_TILES - 1) / SCHEME_CHUNK_TILES;
+    unsigned firstX = chunkId % nChunksX * SCHEME_CHUNK_TILES;
+    unsigned firstY = chunkId / nChunksX * SCHEME_CHUNK_TILES;
+    unsigned nColumns = min(width - firstX, (unsigned)SCHEME_CHUNK_TILES);
+    unsigned nRows = min(height - firstY, (unsigned)SCHEME_CHUNK_TILES);
+
+    if (zoom >= SCHEME_MIN_BATCH_ZOOM)
+    {
+        // batches are built relative to the chunk corner, so panning only moves them
+        if (chunk.batchZoom != zoom)
+        {
+            releaseSchemeChunk(chunkId, chunk, pixels);
+
+            cg::begin_batch(getSchemeBatchName(chunkId));
+            cg::clear();
+
+            cg::set_color(drawColors.defaultGrid);
+            for (unsigned i = 0; i <= nColumns; i++)
+                cg::line(i * zoom, 0., i * zoom, nRows * zoom);
+
+            for (unsigned i = 0; i <= nRows; i++)
+                cg::line(0., i * zoom, nColumns * zoom, i * zoom);
+
+            for (unsigned y = 0; y < nRows; y++)
+            {
+                for (unsigned x = 0; x < nColumns; x++)
+                    drawTile(firstX + x, firstY + y, x * zoom, y * zoom, zoom);
+            }
+
+            cg::end_batch();
+            chunk.batchZoom = zoom;
+        }
+
+        cg::draw_batch(getSchemeBatchName(chunkId), left, top);
+        return;
+    }
+
+    unsigned tileSize = zoom >= SCHEME_MIN_DETAIL_ZOOM ? 4 : 1;
+    unsigned poolId = tileSize > 1;
+
+    bool isReloaded = chunk.imageTileSize != tileSize;
+    if (isReloaded)
+    {
+        releaseSchemeChunk(chunkId, chunk, pixels);
+
+        // buffers fit any chunk, so a buffer serves every chunk after its first
+        if (pixels.freeIds[poolId].empty())
+        {
+            pixels.freeIds[poolId].push_back(pixels.buffers[poolId].size());
+            pixels.buffers[poolId].emplace_back((size_t)SCHEME_CHUNK_TILES * SCHEME_CHUNK_TILES * tileSize * tileSize * 4);
+        }
+
+        chunk.pixelsId = pixels.freeIds[poolId].back();
+        pixels.freeIds[poolId].pop_back();
+
+        rasterizeScheme(firstX, firstY, nColumns, nRows, tileSize, pixels.buffers[poolId][chunk.pixelsId].data());
+        chunk.imageTileSize = tileSize;
+    }
+
+    // edges are rounded outwards so that neighbouring chunks leave no gaps
+    int x1 = (int)std::floor(left);
+    int y1 = (int)std::floor(top);
+    int x2 = (int)std::ceil(left + nColumns * zoom);
+    int y2 = (int)std::ceil(top + nRows * zoom);
+
+    cg::image(pixels.buffers[poolId][chunk.pixelsId].data(), x1, y1, x2 - x1, y2 - y1, nColumns * tileSize, nRows * tileSize, isReloaded);
+}
+
+void MapGen::releaseSchemeChunk(unsigned chunkId, SchemeChunk& chunk, SchemePixels& pixels)
+{
+    // cppgraphics keeps every batch, an empty one takes no memory
+    if (chunk.batchZoom != 0.)
     {
-        for (unsigned x = 0; x < this->width; x++)
+        cg::begin_batch(getSchemeBatchName(chunkId));
+        cg::clear();
+        cg::end_batch();
+    }
+
+    // the buffer keeps its texture until another chunk takes it over
+    if (chunk.pixelsId >= 0)
+        pixels.freeIds[chunk.imageTileSize > 1].push_back(chunk.pixelsId);
+
+    chunk.batchZoom = 0.;
+    chunk.imageTileSize = 0;
+    chunk.pixelsId = -1;
+}
+
+static void fillPixels(uint8_t* pixel, unsigned count, size_t step, const uint8_t color[4])
+{
+    for (unsigned i = 0; i < count; i++, pixel += step)
+        memcpy(pixel, color, 4);
+}
+
+void MapGen::rasterizeScheme(unsigned x, unsigned y, unsigned columns, unsigned rows, unsigned tileSize, uint8_t* pixels)
+{
+    assert(x + columns <= width && y + rows <= height && tileSize > 0);
+
+    // bytes of one pixel row
+    size_t pitch = (size_t)columns * tileSize * 4;
+
+    unsigned doorBegin = tileSize / 4;
+    unsigned doorLength = tileSize - 2 * doorBegin;
+
+    #pragma omp parallel for schedule(static)
+    for (int row = 0; row < (int)rows; row++)
+    {
+        uint8_t* tileRow = pixels + (size_t)row * tileSize * pitch;
+
+        for (unsigned column = 0; column < columns; column++)
         {
-            drawTile(x, y);
+            Tile tile = getTile(x + column, y + row);
+            bool isInRoom = isTileInRoom(tile);
+
+            uint8_t* topLeft = tileRow + (size_t)column * tileSize * 4;
+            uint8_t* topRight = topLeft + (tileSize - 1) * 4;
+            uint8_t* bottomLeft = topLeft + (tileSize - 1) * pitch;
+
+            for (unsigned pixelRow = 0; pixelRow < tileSize; pixelRow++)
+                fillPixels(topLeft + pixelRow * pitch, tileSize, 4, isInRoom ? schemeColors.floor : schemeColors.background);
+
+            // smaller tiles only show the floor
+            if (tileSize < 3)
+                continue;
+
+            if (!isInRoom)
+            {
+                fillPixels(topLeft, tileSize, 4, schemeColors.defaultGrid);
+                fillPixels(topLeft, tileSize, pitch, schemeColors.defaultGrid);
+                continue;
+            }
+
+            // the same lines as drawTile, one pixel wide on the edges of the tile
+            if (hasTileAttrib(tile, TileAttrib::WallUp))
+                fillPixels(topLeft, tileSize, 4, schemeColors.wall);
+
+            if (hasTileAttrib(tile, TileAttrib::WallRight))
+                fillPixels(topRight, tileSize, pitch, schemeColors.wall);
+
+            if (hasTileAttrib(tile, TileAttrib::WallDown))
+                fillPixels(bottomLeft, tileSize, 4, schemeColors.wall);
+
+            if (hasTileAttrib(tile, TileAttrib::WallLeft))
+                fillPixels(topLeft, tileSize, pitch, schemeColors.wall);
+
+            if (hasTileAttrib(tile, TileAttrib::DoorUp))
+                fillPixels(topLeft + doorBegin * 4, doorLength, 4, schemeColors.door);
+
+            if (hasTileAttrib(tile, TileAttrib::DoorRight))
+                fillPixels(topRight + doorBegin * pitch, doorLength, pitch, schemeColors.door);
+
+            if (hasTileAttrib(tile, TileAttrib::DoorDown))
+                fillPixels(bottomLeft + doorBegin * 4, doorLength, 4, schemeColors.door);
+
+            if (hasTileAttrib(tile, TileAttrib::DoorLeft))
+                fillPixels(topLeft + doorBegin * pitch, doorLength, pitch, schemeColors.door);
+        }
+    }
+}
+
+bool MapGen::saveScheme(const std::string& path, unsigned tileSize)
+{
+    if (tileSize == 0)
+    {
+        std::cerr << "Scheme tile size has to be at least 1" << std::endl;
+        return false;
+    }
+
+    std::ofstream file(path, std::ios::binary | std::ios::trunc);
+    if (!file)
+    {
+        std::cerr << "Could not open file " << path << std::endl;
+        return false;
+    }
+
+    size_t rowPixels = (size_t)width * tileSize;
+    file << "P6\n" << rowPixels << " " << (size_t)height * tileSize << "\n255\n";
+
+    // the image is produced in bands of tile rows, so that large maps need little memory
+    size_t bandPixels = rowPixels * tileSize * min(height, (unsigned)SCHEME_BAND_ROWS);
+    vector<uint8_t> pixels(bandPixels * 4);
+    vector<uint8_t> rgb(bandPixels * 3);
+
+    for (unsigned bandBegin = 0; bandBegin < height; bandBegin += SCHEME_BAND_ROWS)
+    {
+        unsigned bandEnd = min(bandBegin + SCHEME_BAND_ROWS, height);
+        rasterizeScheme(0, bandBegin, width, bandEnd - bandBegin, tileSize, pixels.data());
+
+        // PPM has no alpha channel
+        long long nPixels = (long long)(rowPixels * tileSize * (bandEnd - bandBegin));
+
+        #pragma omp parallel for schedule(static)
+        for (long long i = 0; i < nPixels; i++)
+        {
+            rgb[i * 3] = pixels[i * 4];
+            rgb[i * 3 + 1] = pixels[i * 4 + 1];
+            rgb[i * 3 + 2] = pixels[i * 4 + 2];
         }
+
+        file.write((const char*)rgb.data(), nPixels * 3);
+    }
+
+    if (!file)
+    {
+        std::cerr << "Could not write scheme " << path << std::endl;
+        return false;
     }
 
-    cg::wait_until_closed();
+    return true;
 }
@@ -1,20 +1,53 @@
 ﻿#include "gl_scene.hpp"
 
-GLScene GLScene::create(float width, float height, MapGen *map, std::vector<std::vector<unsigned>> visibilities)
+GLScene GLScene::create(float width, float height, MapGen *map, RoomGraph* graph, VisibilityMatrix* visibilities, TileVisibility* tileVisibilities)
 {
-    GLScene portals(width, height, map, visibilities);
+    GLScene portals(width, height, map, graph, visibilities, tileVisibilities);
     if (!portals.init())
         throw std::runtime_error("Could not open shader files!");
 
     return portals;
 }
 
-GLScene::GLScene(float width, float height, MapGen* map, std::vector<std::vector<unsigned>> visibilities)
+GLScene GLScene::createChunked(float width, float height, ChunkedWorld* world)
+{
+    GLScene portals = create(width, height, &world->window, &world->graph, &world->visibilities);
+    portals.world = world;
+
+    // start on the first room tile of the center chunk
+    unsigned chunkStart = world->radius * world->chunkSize;
+    for (unsigned i = 0; i < world->chunkSize * world->chunkSize; i++)
+    {
+        unsigned x = chunkStart + i % world->chunkSize;
+        unsigned y = chunkStart + i / world->chunkSize;
+
+        if (!world->window.isTileInRoom(world->window.getTile(x, y)))
+            continue;
+
+        portals.location.x = -(x + 0.5f) * SS_TILE_SIDE;
+        portals.location.z = -(y + 0.5f) * SS_TILE_SIDE;
+        break;
+    }
+
+    return portals;
+}
+
+GLScene GLScene::createSectored(float width, float height, MapGen* map, RoomGraph* graph, SectorVisibility* sectorVisibilities)
+{
+    GLScene portals = create(width, height, map, graph, nullptr);
+    portals.sectorVisibilities = sectorVisibilities;
+
+    return portals;
+}
+
+GLScene::GLScene(float width, float height, MapGen* map, RoomGraph* graph, VisibilityMatrix* visibilities, TileVisibility* tileVisibilities)
 {
     windowWidth = width;
     windowHeight = height;
     this->map = map;
+    this->graph = graph;
     this->visibilities = visibilities;
+    this->tileVisibilities = tileVisibilities;
 
     topDownViewport = {
         0,
@@ -26,30 +59,38 @@ GLScene::GLScene(float width, float height, MapGen* map, std::vector<std::vector
 
 void GLScene::printFrameStatistics()
 {
-    if (fpsBuffer.size() == 0)
-        return;
+    for (unsigned mode = 0; mode <= (unsigned)VisibilityMode::Count; mode++)
+    {
+        FrameStatistics& statistics = frameStatistics[mode];
+        std::vector<float>& fpsBuffer = statistics.fpsBuffer;
 
-    fpsBuffer.erase(fpsBuffer.begin());
-    std::sort(fpsBuffer.begin(), fpsBuffer.end());
+        if (fpsBuffer.size() < 2)
+            continue;
 
-    std::cout << "Median FPS: " << fpsBuffer[fpsBuffer.size() / 2] << std::endl;
+        std::cout << "Drawing " << visibilityModeNames[mode] << ", " << fpsBuffer.size() << " frames" << std::endl;
+        std::cout << "Average rendered instances: " << statistics.nRenderedInstances / fpsBuffer.size() << std::endl;
+        std::cout << "Average visibility update time: " << statistics.visibilityTime / fpsBuffer.size() * 1e3 << " ms" << std::endl;
 
-    float avg = 0;
-    float percent99 = 0;
-    for (unsigned i = 0; i < fpsBuffer.size(); i++)
-    {
-        avg += fpsBuffer[i];
+        fpsBuffer.erase(fpsBuffer.begin());
+        std::sort(fpsBuffer.begin(), fpsBuffer.end());
 
-        if (i == fpsBuffer.size() / 99)
-        {
-            percent99 = avg / i;
-        }
-    }
+        std::cout << "Median FPS: " << fpsBuffer[fpsBuffer.size() / 2] << std::endl;
 
-    std::cout << "Average FPS: " << avg / fpsBuffer.size() << std::endl;
-    std::cout << "99% FPS: " << percent99 << std::endl;
+        float avg = 0;
+        float percent99 = 0;
+        for (unsigned i = 0; i < fpsBuffer.size(); i++)
+        {
+            avg += fpsBuffer[i];
 
+            if (i == fpsBuffer.size() / 99)
+            {
+                percent99 = avg / i;
+            }
+        }
 
+        std::cout << "Average FPS: " << avg / fpsBuffer.size() << std::endl;
+        std::cout << "99% FPS: " << percent99 << std::endl;
+    }
 }
 
 GLScene::~GLScene()
@@ -108,6 +149,18 @@ bool GLScene::handleEvents()
         if (event.type == SDL_EVENT_KEY_UP)
             keyDown[event.key.key] = 0;
 
+        // a door toggles once per press
+        if (event.type == SDL_EVENT_KEY_DOWN && event.key.key == SDLK_T && !event.key.repeat)
+            isDoorToggleRequested = true;
+
+        if (event.type == SDL_EVENT_KEY_DOWN && event.key.key == SDLK_R && !event.key.repeat)
+        {
+            visibilityMode = (VisibilityMode)(((unsigned)visibilityMode + 1) % (unsigned)VisibilityMode::Count);
+            // the visible tiles are collected again in the new mode
+            visibleRoomId = -1;
+            std::cout << "Drawing " << visibilityModeNames[(unsigned)visibilityMode] << std::endl;
+        }
+
         if (event.type == SDL_EVENT_MOUSE_MOTION)
         {
             if (event.motion.state & SDL_BUTTON_RMASK)
@@ -143,7 +196,7 @@ bool GLScene::handleEvents()
 
 void GLScene::cameraCollisions(float timeDiff)
 {
-    MapGen::Tile& tile = map->getTile(currentTile.x, currentTile.y);
+    MapGen::Tile tile = map->getTile(currentTile.x, currentTile.y);
 
     if (map->hasTileAttrib(tile, TileAttrib::DoorLeft))
     {
@@ -281,6 +334,8 @@ void GLScene::updateCameraFpv(std::shared_ptr<Program> fpvPrg, float timeDiff)
     fpvPrg->setMatrix4fv("view", (float*)&view);
     fpvPrg->setMatrix4fv("proj", (float*)&proj);
 
+    viewProj = proj * view;
+
     auto defaultDir = glm::vec4(0.f, 0.f, 1.f, 0.f);
     auto dir = defaultDir * rotation;
     fpvPrg->set3f("dir", dir.x, dir.y, dir.z);
@@ -289,7 +344,7 @@ void GLScene::updateCameraFpv(std::shared_ptr<Program> fpvPrg, float timeDiff)
 // Add instance Ids of either doors or walls
 void GLScene::addVerticalInstancesAt(unsigned x, unsigned y, std::vector<glm::mat4>& instances, TileAttrib verticalAttribUp)
 {
-    MapGen::Tile& tile = map->getTile(x, y);
+    MapGen::Tile tile = map->getTile(x, y);
 
     for (unsigned i = 0; i < modelTileStarts.size(); i++)
     {
@@ -332,7 +387,7 @@ void GLScene::addInstances()
             wallTileOffsets.push_back(wallInstances.size());
             floorTileOffsets.push_back(floorInstances.size());
 
-            MapGen::Tile& tile = map->getTile(x, y);
+            MapGen::Tile tile = map->getTile(x, y);
             if (!map->isTileInRoom(tile))
                 continue;
 
@@ -379,25 +434,285 @@ void GLScene::updateInstanceIds(Model& model, std::vector<unsigned>& instanceTil
     model.glUpdateInstanceId();
 }
 
+// Recenters the world window once the camera leaves its center chunk
+bool GLScene::updateWorldWindow()
+{
+    glm::ivec2 cameraTile = glm::floor(glm::vec2(-location.x, -location.z) / SS_TILE_SIDE);
+    glm::ivec2 globalTile = world->getWindowOrigin() + cameraTile;
+    glm::ivec2 cameraChunk = glm::floor(glm::vec2(globalTile) / (float)world->chunkSize);
+
+    glm::ivec2 oldOrigin = world->getWindowOrigin();
+    if (!world->setCenter(cameraChunk))
+        return false;
+
+    // keep the camera on the same global position inside the moved window
+    glm::ivec2 originShift = world->getWindowOrigin() - oldOrigin;
+    location.x += originShift.x * SS_TILE_SIDE;
+    location.z += originShift.y * SS_TILE_SIDE;
+
+    // the rest of the frame already works in the moved window
+    currentTile.x = -location.x / SS_TILE_SIDE;
+    currentTile.y = -location.z / SS_TILE_SIDE;
+
+    map = &world->window;
+    graph = &world->graph;
+    visibilities = &world->visibilities;
+    visibleRoomId = -1;
+
+    std::cout << "World window centered on chunk " << cameraChunk.x << ", " << cameraChunk.y
+        << " (" << world->getResidentChunks() << " chunks resident)" << std::endl;
+
+    return true;
+}
+
+void GLScene::reloadInstances(const std::vector<Model*>& models)
+{
+    doorTileOffsets = {};
+    doorInstances = {};
+    wallTileOffsets = {};
+    wallInstances = {};
+    floorTileOffsets = {};
+    floorInstances = {};
+
+    addInstances();
+
+    models[0]->glUpdateInstanceMatrices(doorInstances);
+    models[1]->glUpdateInstanceMatrices(wallInstances);
+    models[2]->glUpdateInstanceMatrices(floorInstances);
+}
+
 void GLScene::updateVisibility()
 {
     if (currentTile.x >= map->width || currentTile.y >= map->height)
         return;
 
     MapGen::Tile tile = map->getTile(currentTile.x, currentTile.y);
+    unsigned tileId = currentTile.y * map->width + currentTile.x;
     if (!map->isTileInRoom(tile))
         return;
 
-    visibleTileIds = {};
-    for (auto roomId : visibilities[tile.roomId])
+    // the precomputed rooms only change with the room, or with the tile if tiles have their own
+    bool isSameTile = tileVisibilities == nullptr || (int)tileId == visibleTileId;
+    bool isPrecomputedChanged = (int)tile.roomId != visibleRoomId || !isSameTile;
+
+    if ((int)tile.roomId != visibleRoomId)
+    {
+        visibleRoomId = tile.roomId;
+
+        if (sectorVisibilities != nullptr)
+        {
+            // sectors are searched as the camera reaches them and dropped once it is far away
+            sectorVisibilities->evict(sectorVisibilities->getSectorId(tile.roomId), SECTOR_RESIDENT_RADIUS);
+            sectorVisibilities->getRow(tile.roomId, visibleRoomIds);
+        }
+        else
+        {
+            visibilities->getRow(tile.roomId, visibleRoomIds);
+        }
+    }
+
+    const std::vector<unsigned>* roomIds = &visibleRoomIds;
+
+    if (tileVisibilities != nullptr)
+    {
+        if (!isSameTile)
+        {
+            std::span<const unsigned> roomTiles = graph->getTiles(tile.roomId);
+            unsigned tileIndex = std::lower_bound(roomTiles.begin(), roomTiles.end(), tileId) - roomTiles.begin();
+
+            visibleTileId = tileId;
+            tileVisibilities->getRow(tile.roomId, tileIndex, visibleRoomIds, tileRoomIds);
+        }
+
+        roomIds = &tileRoomIds;
+    }
+
+    if (visibilityMode == VisibilityMode::Precomputed && !isPrecomputedChanged)
+        return;
+
+    // the rooms through the doors change with every camera move
+    if (visibilityMode != VisibilityMode::Precomputed)
+    {
+        updatePortalVisibility(tile.roomId, visibilityMode == VisibilityMode::Combined ? roomIds : nullptr);
+        roomIds = &portalRoomIds;
+    }
+
+    visibleTileIds.clear();
+    for (auto roomId : *roomIds)
+    {
+        std::span<const unsigned> tiles = graph->getTiles(roomId);
+        visibleTileIds.insert(visibleTileIds.end(), tiles.begin(), tiles.end());
+    }
+}
+
+void GLScene::updatePortalVisibility(unsigned roomId, const std::vector<unsigned>* precomputedRoomIds)
+{
+    for (unsigned searchedRoomId : portalRoomIds)
+        portalRoomSlots[searchedRoomId] = UINT_MAX;
+    portalRoomSlots.resize(graph->getRoomCount(), UINT_MAX);
+
+    portalRoomIds = { roomId };
+    portalRoomSlots[roomId] = 0;
+    portalStack = { { roomId, glm::vec4(-1.f, -1.f, 1.f, 1.f) } };
+    if (searchedRects.empty())
+        searchedRects.emplace_back();
+    searchedRects[0] = { portalStack.back().second };
+
+    glm::vec2 camera = glm::vec2(-location.x, -location.z) / SS_TILE_SIDE;
+
+    while (!portalStack.empty())
     {
-        for (auto tileCoords : map->rooms[roomId].segments)
+        auto [currentRoomId, currentRect] = portalStack.back();
+        portalStack.pop_back();
+
+        for (const auto& door : graph->getDoors(currentRoomId))
         {
-            visibleTileIds.push_back(tileCoords.y * map->width + tileCoords.x);
+            if (precomputedRoomIds != nullptr &&
+                !std::binary_search(precomputedRoomIds->begin(), precomputedRoomIds->end(), door.otherRoomId))
+                continue;
+
+            glm::vec4 rect = currentRect;
+
+            // the door seen from inside its opening covers the screen, projected it is only a line
+            glm::vec2 doorVec = door.locations[1] - door.locations[0];
+            float t = glm::clamp(glm::dot(camera - door.locations[0], doorVec) / glm::dot(doorVec, doorVec), 0.f, 1.f);
+            bool isInDoor = glm::distance(camera, door.locations[0] + t * doorVec) * SS_TILE_SIDE < SS_WALL_WIDTH;
+
+            glm::vec4 doorRect;
+            if (!isInDoor)
+            {
+                if (!getDoorScreenRect(door, doorRect))
+                    continue;
+
+                rect = glm::vec4(glm::max(glm::vec2(rect), glm::vec2(doorRect)), glm::min(glm::vec2(rect.z, rect.w), glm::vec2(doorRect.z, doorRect.w)));
+                if (rect.x > rect.z || rect.y > rect.w)
+                    continue;
+            }
+
+            // the room was already searched through a wider rectangle
+            unsigned& slot = portalRoomSlots[door.otherRoomId];
+            if (slot == UINT_MAX)
+            {
+                slot = portalRoomIds.size();
+                portalRoomIds.push_back(door.otherRoomId);
+
+                if (slot == searchedRects.size())
+                    searchedRects.emplace_back();
+                searchedRects[slot].clear();
+            }
+
+            std::vector<glm::vec4>& rects = searchedRects[slot];
+            bool isSearched = std::any_of(rects.begin(), rects.end(), [&rect](const glm::vec4& searched)
+            {
+                return searched.x <= rect.x && searched.y <= rect.y && searched.z >= rect.z && searched.w >= rect.w;
+            });
+
+            if (isSearched)
+                continue;
+
+            rects.push_back(rect);
+            portalStack.push_back({ door.otherRoomId, rect });
         }
     }
 }
 
+bool GLScene::getDoorScreenRect(const RoomGraph::Door& door, glm::vec4& rect)
+{
+    // the opening runs from the floor to the top of the wall, taken on the middle of the wall
+    glm::vec4 corners[4];
+    for (unsigned i = 0; i < 4; i++)
+    {
+        glm::vec2 location = door.locations[(i + 1) / 2 % 2] * SS_TILE_SIDE;
+        corners[i] = viewProj * glm::vec4(location.x, i < 2 ? 0.f : SS_WALL_HEIGHT, location.y, 1.f);
+    }
+
+    // clip the opening to the near plane before dividing by w
+    const float nearW = 0.01f;
+    bool isInFront = false;
+    rect = glm::vec4(FLT_MAX, FLT_MAX, -FLT_MAX, -FLT_MAX);
+
+    auto addPoint = [&rect, &isInFront](const glm::vec4& point)
+    {
+        glm::vec2 ndc = glm::vec2(point) / point.w;
+        rect = glm::vec4(glm::min(glm::vec2(rect), ndc), glm::max(glm::vec2(rect.z, rect.w), ndc));
+        isInFront = true;
+    };
+
+    for (unsigned i = 0; i < 4; i++)
+    {
+        const glm::vec4& first = corners[i];
+        const glm::vec4& second = corners[(i + 1) % 4];
+
+        if (first.w >= nearW)
+            addPoint(first);
+
+        if ((first.w >= nearW) != (second.w >= nearW))
+            addPoint(first + (second - first) * ((nearW - first.w) / (second.w - first.w)));
+    }
+
+    return isInFront;
+}
+
+// Adds or removes the door on the wall of the current tile nearest to the camera and
+// recomputes the visibility rows the door can change
+bool GLScene::toggleDoor()
+{
+    if (currentTile.x >= map->width || currentTile.y >= map->height)
+        return false;
+
+    MapGen::Tile tile = map->getTile(currentTile.x, currentTile.y);
+    if (!map->isTileInRoom(tile))
+        return false;
+
+    // distances to the up, right, down and left edge, in the order of the door attributes
+    glm::vec2 inTile = glm::vec2(-location.x, -location.z) / SS_TILE_SIDE - glm::vec2(currentTile);
+    float edgeDistances[4] = { inTile.y, 1.f - inTile.x, 1.f - inTile.y, inTile.x };
+    unsigned direction = std::min_element(edgeDistances, edgeDistances + 4) - edgeDistances;
+
+    TileAttrib doorAttrib = (TileAttrib)((unsigned)TileAttrib::DoorUp << direction);
+    glm::ivec2 otherTile = glm::ivec2(currentTile) + MapGen::otherTileOffsetFromDoorAttrib.at(doorAttrib);
+
+    bool isRemoval = map->hasTileAttrib(tile, doorAttrib);
+    bool isToggled = isRemoval ? map->removeDoor(doorAttrib, currentTile.x, currentTile.y) : map->addDoor(doorAttrib, currentTile.x, currentTile.y);
+    if (!isToggled)
+        return false;
+
+    unsigned roomId = tile.roomId;
+    unsigned otherRoomId = map->getTile(otherTile.x, otherTile.y).roomId;
+
+    auto start = SDL_GetPerformanceCounter();
+
+    graph->updateDoors(*map, { roomId, otherRoomId });
+
+    // stale sectors are only dropped here, they are searched again once the camera needs them
+    if (sectorVisibilities != nullptr)
+    {
+        unsigned nSectors = sectorVisibilities->invalidate(roomId, otherRoomId);
+        visibleRoomId = -1;
+
+        std::cout << (isRemoval ? "Door removed, " : "Door added, ") << nSectors << " visibility sectors dropped" << std::endl;
+        return true;
+    }
+
+    PortalVisibility portal(graph);
+    std::vector<unsigned> updatedRoomIds = portal.updateVisibilities(*visibilities, roomId, otherRoomId);
+    size_t nRows = updatedRoomIds.size();
+
+    if (tileVisibilities != nullptr)
+        portal.updateTileVisibilities(*tileVisibilities, *visibilities, updatedRoomIds);
+
+    double updateTime = (SDL_GetPerformanceCounter() - start) / (double)SDL_GetPerformanceFrequency();
+
+    // the row of the camera room is decoded again
+    visibleRoomId = -1;
+    visibleTileId = -1;
+
+    std::cout << (isRemoval ? "Door removed, " : "Door added, ") << nRows << " visibility rows updated in "
+        << updateTime * 1e3 << " ms" << std::endl;
+
+    return true;
+}
+
 bool GLScene::run()
 {
     auto window = SDL_CreateWindow("PGR", windowWidth, windowHeight, SDL_WINDOW_OPENGL);
@@ -450,7 +765,8 @@ bool GLScene::run()
         startTime = stopTime;
 
         float fps = (1 / timeDiff);
-        fpsBuffer.push_back(fps);
+        FrameStatistics& statistics = frameStatistics[useVisibility ? (unsigned)visibilityMode : (unsigned)VisibilityMode::Count];
+        statistics.fpsBuffer.push_back(fps);
 
         if ((stopTime - fpsDisplayStartTime) / (float)SDL_GetPerformanceFrequency() > .25f)
         {
@@ -461,23 +777,38 @@ bool GLScene::run()
 
         updateCameraFpv(fpvPrg, timeDiff);
 
+        if (world != nullptr && updateWorldWindow())
+            reloadInstances(models);
+
+        // the world window is generated again on every recenter, so doors only toggle on plain maps
+        if (isDoorToggleRequested && world == nullptr && toggleDoor())
+            reloadInstances(models);
+
+        isDoorToggleRequested = false;
+
         // update
 
+        auto visibilityStart = SDL_GetPerformanceCounter();
+
         if (useVisibility)
         {
             updateVisibility();
         }
         else
         {
+            visibleRoomId = -1;
             visibleTileIds = {};
             for (unsigned i = 0; i < map->width * map->height; i++)
                 visibleTileIds.push_back(i);
 
         }
 
+        statistics.visibilityTime += (SDL_GetPerformanceCounter() - visibilityStart) / (double)SDL_GetPerformanceFrequency();
+
         for (unsigned i = 0; i < models.size(); i++)
         {
             updateInstanceIds(*models[i], *modelsTileOffsets[i]);
+            statistics.nRenderedInstances += models[i]->instanceIds.size();
         }
         
 
@@ -21,6 +21,12 @@
 #include <assimp/postprocess.h>
 
 #include "map_gen.hpp"
+#include "chunked_world.hpp"
+#include "portal_visibility.hpp"
+#include "room_graph.hpp"
+#include "sector_visibility.hpp"
+#include "tile_visibility.hpp"
+#include "visibility_matrix.hpp"
 
 #ifndef SRC_DIR
 #define SRC_DIR "."
@@ -32,9 +38,13 @@
 
 #define SS_TILE_SIDE 6.3f
 #define SS_WALL_WIDTH SS_TILE_SIDE / (24)
+#define SS_WALL_HEIGHT 3.1f
 
 #define COLLISION_DISTANCE 2 * SS_WALL_WIDTH
 
+// searched sectors kept around the camera sector, in sectors on either axis
+#define SECTOR_RESIDENT_RADIUS 2
+
 using namespace ge::gl;
 
 enum class GlBufferType
@@ -58,6 +68,7 @@ public:
     void render(std::shared_ptr<Program> prg);
     void render(std::shared_ptr<Program> prg, glm::vec4 color);
     void glUpdateInstanceId();
+    void glUpdateInstanceMatrices(std::vector<glm::mat4>& instanceMatrices);
 
 private:
     struct Vertices
@@ -97,7 +108,12 @@ private:
 class GLScene
 {
 public:
-    static GLScene create(float width, float height, MapGen* map, std::vector<std::vector<unsigned>> visibilities);
+    // Draws the rooms visible from the camera tile instead of its room if tileVisibilities are given
+    static GLScene create(float width, float height, MapGen* map, RoomGraph* graph, VisibilityMatrix* visibilities, TileVisibility* tileVisibilities = nullptr);
+    // Scene walking through the world window, which follows the camera
+    static GLScene createChunked(float width, float height, ChunkedWorld* world);
+    // Scene searching the visibilities of the sectors the camera walks through
+    static GLScene createSectored(float width, float height, MapGen* map, RoomGraph* graph, SectorVisibility* sectorVisibilities);
     bool run();
     
     ~GLScene();
@@ -137,11 +153,37 @@ private:
     glm::vec4 topDownDoorColor = { 1.f, 1.f, 0.f, 1.f };
     glm::vec4 topDownFloorColor = { 0.1f, 0.1f, 0.1f, 1.f };
 
+    // rooms drawn when visibility is used, switched by R
+    enum class VisibilityMode
+    {
+        // the precomputed rooms of the camera room or tile
+        Precomputed,
+        // rooms reached through doors on screen from the camera room, searched every frame
+        Portals,
+        // rooms reached through doors on screen that are also precomputed as visible
+        Combined,
+        Count
+    };
+
+    inline static const char* visibilityModeNames[] = { "precomputed", "portals", "precomputed and portals", "all tiles" };
+
+    struct FrameStatistics
+    {
+        std::vector<float> fpsBuffer;
+        // instances drawn in all frames together
+        unsigned long long nRenderedInstances = 0;
+        double visibilityTime = 0;
+    };
+
     bool noclip = false;
     bool useVisibility = true;
+    VisibilityMode visibilityMode = VisibilityMode::Precomputed;
     bool drawMinimap = true;
+    bool isDoorToggleRequested = false;
 
     MapGen *map;
+    RoomGraph* graph;
+    ChunkedWorld* world = nullptr;
 
     glm::uvec2 currentTile = {0, 0};
 
@@ -155,11 +197,28 @@ private:
     std::vector<glm::mat4> wallInstances;
 
     std::vector<unsigned> visibleTileIds;
-    std::vector<std::vector<unsigned>> visibilities;
-
-    std::vector<float> fpsBuffer;
-
-    GLScene(float width, float height, MapGen* map, std::vector<std::vector<unsigned>> visibilities);
+    VisibilityMatrix* visibilities;
+    // row of the room the camera is in, decoded only when the camera enters another room
+    std::vector<unsigned> visibleRoomIds;
+    int visibleRoomId = -1;
+    TileVisibility* tileVisibilities = nullptr;
+    SectorVisibility* sectorVisibilities = nullptr;
+    // rooms of the row visible from the camera tile
+    std::vector<unsigned> tileRoomIds;
+    int visibleTileId = -1;
+
+    glm::mat4 viewProj{ 1.f };
+    // rooms reached through doors on screen and the screen rectangles they were searched with,
+    // by the slot of the room in portalRoomIds. Only the slots of the last search are reset.
+    std::vector<unsigned> portalRoomIds;
+    std::vector<unsigned> portalRoomSlots;
+    std::vector<std::vector<glm::vec4>> searchedRects;
+    std::vector<std::pair<unsigned, glm::vec4>> portalStack;
+
+    // per visibility mode, the last one for drawing all tiles
+    FrameStatistics frameStatistics[(unsigned)VisibilityMode::Count + 1];
+
+    GLScene(float width, float height, MapGen* map, RoomGraph* graph, VisibilityMatrix* visibilities, TileVisibility* tileVisibilities);
     bool init();
 
     void printFrameStatistics();
@@ -172,9 +231,19 @@ private:
     void cameraCollisions(float timeDiff);
 
     void updateVisibility();
+    // Searches the rooms seen through the doors from the camera room, only entering the
+    // precomputed rooms if they are given
+    void updatePortalVisibility(unsigned roomId, const std::vector<unsigned>* precomputedRoomIds);
+    // Bounds of the door opening on screen in normalized device coordinates as min x, min y,
+    // max x, max y. Returns false if the opening is behind the camera.
+    bool getDoorScreenRect(const RoomGraph::Door& door, glm::vec4& rect);
+    bool toggleDoor();
     void updateInstanceIds(Model& model, std::vector<unsigned>& instanceTileOffsets);
 
     void addVerticalInstancesAt(unsigned x, unsigned y, std::vector<glm::mat4>& instances, TileAttrib verticalAttribUp);
     void addFloorInstancesAt(unsigned x, unsigned y);
     void addInstances();
+
+    bool updateWorldWindow();
+    void reloadInstances(const std::vector<Model*>& models);
 };
\ No newline at end of file
@@ -2,22 +2,150 @@
 #include "map_gen.hpp"
 #include "gl_scene.hpp"
 #include "portal_visibility.hpp"
+#include "benchmarks.hpp"
+#include "pvs_partition.hpp"
 
-int main()
+int main(int argc, char* argv[])
 {
+    std::vector<std::string> args(argv + 1, argv + argc);
+
+    if (args.size() > 0 && args[0] == "--bench")
+        return Benchmarks::run(std::vector<std::string>(args.begin() + 1, args.end()));
+
+    if (args.size() > 0 && (args[0] == "--pvs-range" || args[0] == "--pvs-merge" || args[0] == "--pvs-workers"))
+        return PvsPartition::run(argv[0], args);
+
     unsigned seed = (unsigned)time(0);
+    bool isChunked = false;
+    unsigned chunkSize = 24;
+    unsigned chunkRadius = 1;
+    std::string loadPath;
+    std::string savePath;
+    unsigned mapSize = 50;
+    std::string schemePath;
+    unsigned schemeTileSize = 4;
+    std::string pvsCacheDirectory = "pvs_cache";
+    bool useTileVisibility = false;
+    unsigned sectorSide = 0;
+
+    for (unsigned i = 0; i < args.size(); i++)
+    {
+        if (args[i] == "--seed" && i + 1 < args.size())
+            seed = std::stoul(args[++i]);
+
+        if (args[i] == "--load" && i + 1 < args.size())
+            loadPath = args[++i];
+
+        if (args[i] == "--save" && i + 1 < args.size())
+            savePath = args[++i];
+
+        // visibilities of already seen maps are loaded from the directory, empty to always compute them
+        if (args[i] == "--pvs-cache" && i + 1 < args.size())
+            pvsCacheDirectory = args[++i];
+
+        if (args[i] == "--no-pvs-cache")
+            pvsCacheDirectory = "";
+
+        // draw what is visible from the camera tile instead of the whole room
+        if (args[i] == "--tile-pvs")
+            useTileVisibility = true;
+
+        // --sector-pvs [sector side], search visibilities a sector of tiles at a time as the camera walks
+        if (args[i] == "--sector-pvs")
+        {
+            sectorSide = 32;
+
+            if (i + 1 < args.size() && isdigit(args[i + 1][0]))
+                sectorSide = std::stoul(args[++i]);
+        }
+
+        if (args[i] == "--size" && i + 1 < args.size())
+            mapSize = std::stoul(args[++i]);
+
+        // --scheme path [tile size], written instead of showing the scheme window
+        if (args[i] == "--scheme" && i + 1 < args.size())
+        {
+            schemePath = args[++i];
+
+            if (i + 1 < args.size() && isdigit(args[i + 1][0]))
+                schemeTileSize = std::stoul(args[++i]);
+        }
+
+        // --chunked [chunk size] [radius]
+        if (args[i] == "--chunked")
+        {
+            isChunked = true;
+
+            if (i + 1 < args.size() && isdigit(args[i + 1][0]))
+                chunkSize = std::stoul(args[++i]);
+
+            if (i + 1 < args.size() && isdigit(args[i + 1][0]))
+                chunkRadius = std::stoul(args[++i]);
+        }
+    }
+
     std::cerr << seed << std::endl << std::endl;
-    srand(seed);
 
-    MapGen mapGen = MapGen(50, 50);
+    if (isChunked)
+    {
+        ChunkedWorld world(seed, chunkSize, chunkRadius);
+        world.setCenter({ 0, 0 });
+
+        auto scene = GLScene::createChunked(2560.f, 1440.f, &world);
+        scene.run();
+
+        return 0;
+    }
+
+    MapGen mapGen = MapGen(mapSize, mapSize, seed);
+
+    if (loadPath.empty())
+        mapGen.generate();
+    else if (!mapGen.load(loadPath))
+        return 1;
+
+    if (!savePath.empty() && !mapGen.save(savePath))
+        return 1;
+
+    if (schemePath.empty())
+        mapGen.drawScheme(1000.);
+    else if (!mapGen.saveScheme(schemePath, schemeTileSize))
+        return 1;
+
+    RoomGraph graph = RoomGraph::build(mapGen);
+
+    if (sectorSide != 0)
+    {
+        // sectors keep rows of rooms only
+        if (useTileVisibility)
+        {
+            std::cerr << "Sectors do not work with --tile-pvs" << std::endl;
+            return 1;
+        }
+
+        SectorVisibility sectorVisibilities(&graph, mapGen, sectorSide);
+
+        auto scene = GLScene::createSectored(2560.f, 1440.f, &mapGen, &graph, &sectorVisibilities);
+        scene.run();
+
+        std::cout << "Searched sectors: " << sectorVisibilities.getSearchedSectorCount() << ", "
+            << sectorVisibilities.getBytes() / 1024 << " KiB" << std::endl;
+
+        return 0;
+    }
 
-    mapGen.generate();
-    mapGen.drawScheme(1000.);
+    PortalVisibility portal(&graph);
+    VisibilityMatrix visibilities = pvsCacheDirectory.empty() ? portal.getVisibilities() : portal.getCachedVisibilities(mapGen, pvsCacheDirectory);
 
-    PortalVisibility portal = PortalVisibility::getFromMap(&mapGen);
-    auto visibilities = portal.getVisibilities();
+    TileVisibility tileVisibilities;
+    if (useTileVisibility)
+    {
+        tileVisibilities = portal.getTileVisibilities(visibilities);
+        std::cout << "Tile visibilities: " << tileVisibilities.getBytes() / 1024 << " KiB, room visibilities: "
+            << visibilities.getBytes() / 1024 << " KiB" << std::endl;
+    }
 
-    auto scene = GLScene::create(2560.f, 1440.f, &mapGen, visibilities);
+    auto scene = GLScene::create(2560.f, 1440.f, &mapGen, &graph, &visibilities, useTileVisibility ? &tileVisibilities : nullptr);
     scene.run();
 
     
@@ -0,0 +1,297 @@
+#include "map_gen.hpp"
+
+#include <bit>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <type_traits>
+
+#ifdef _WIN32
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+// segments are written and mapped as Points
+static_assert(sizeof(Point) == 2 * sizeof(int32_t) && std::is_standard_layout_v<Point>);
+
+MappedFile* MappedFile::open(const std::string& path)
+{
+    MappedFile* file = new MappedFile();
+
+#ifdef _WIN32
+    file->fileHandle = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (file->fileHandle == INVALID_HANDLE_VALUE)
+    {
+        file->fileHandle = nullptr;
+        delete file;
+        return nullptr;
+    }
+
+    LARGE_INTEGER size;
+    if (!GetFileSizeEx(file->fileHandle, &size) || size.QuadPart == 0)
+    {
+        delete file;
+        return nullptr;
+    }
+    file->size = size.QuadPart;
+
+    file->mappingHandle = CreateFileMappingA(file->fileHandle, nullptr, PAGE_WRITECOPY, 0, 0, nullptr);
+    if (file->mappingHandle != nullptr)
+        file->data = (uint8_t*)MapViewOfFile(file->mappingHandle, FILE_MAP_COPY, 0, 0, 0);
+#else
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+    {
+        delete file;
+        return nullptr;
+    }
+
+    struct stat status;
+    if (fstat(fd, &status) == 0 && status.st_size > 0)
+    {
+        file->size = status.st_size;
+
+        void* data = mmap(nullptr, file->size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+        file->data = data == MAP_FAILED ? nullptr : (uint8_t*)data;
+    }
+
+    // the mapping stays valid without the descriptor
+    close(fd);
+#endif
+
+    if (file->data == nullptr)
+    {
+        delete file;
+        return nullptr;
+    }
+
+    return file;
+}
+
+MappedFile::~MappedFile()
+{
+#ifdef _WIN32
+    if (data != nullptr)
+        UnmapViewOfFile(data);
+
+    if (mappingHandle != nullptr)
+        CloseHandle(mappingHandle);
+
+    if (fileHandle != nullptr)
+        CloseHandle(fileHandle);
+#else
+    if (data != nullptr)
+        munmap(data, size);
+#endif
+}
+
+uint64_t alignOffset(uint64_t offset)
+{
+    return (offset + MAP_FILE_ALIGNMENT - 1) / MAP_FILE_ALIGNMENT * MAP_FILE_ALIGNMENT;
+}
+
+bool isSectionInFile(uint64_t offset, uint64_t bytes, uint64_t fileSize)
+{
+    return offset % MAP_FILE_ALIGNMENT == 0 && bytes <= fileSize && offset <= fileSize - bytes;
+}
+
+void writePadding(std::ostream& file, uint64_t offset)
+{
+    const char zeros[MAP_FILE_ALIGNMENT] = {};
+    file.write(zeros, alignOffset(offset) - offset);
+}
+
+uint64_t hashBytes(const void* data, uint64_t size, uint64_t hash)
+{
+    const uint8_t* bytes = (const uint8_t*)data;
+
+    auto mix = [&](uint64_t word)
+    {
+        hash = std::rotl((hash ^ word) * 0x9e3779b97f4a7c15ull, 29) * 0xbf58476d1ce4e5b9ull;
+    };
+
+    uint64_t i = 0;
+    for (; i + sizeof(uint64_t) <= size; i += sizeof(uint64_t))
+    {
+        uint64_t word;
+        memcpy(&word, bytes + i, sizeof(word));
+        mix(word);
+    }
+
+    if (i < size)
+    {
+        uint64_t word = 0;
+        memcpy(&word, bytes + i, size - i);
+        mix(word);
+    }
+
+    // the size keeps trailing zeros from hashing like no bytes
+    mix(size);
+    return hash ^ (hash >> 31);
+}
+
+uint64_t MapGen::getContentHash()
+{
+    uint64_t nTiles = (uint64_t)width * height;
+    uint32_t sizes[3] = { width, height, getRoomCount() };
+
+    uint64_t hash = hashBytes(sizes, sizeof(sizes));
+    hash = hashBytes(tiles.roomIds, nTiles * sizeof(int32_t), hash);
+    return hashBytes(tiles.statuses, nTiles * sizeof(uint8_t), hash);
+}
+
+bool MapGen::save(const std::string& path)
+{
+    // sections are written straight from memory
+    if constexpr (std::endian::native != std::endian::little)
+    {
+        std::cerr << "Map files can only be written on little-endian machines" << std::endl;
+        return false;
+    }
+
+    uint64_t nTiles = (uint64_t)width * height;
+    unsigned nRooms = getRoomCount();
+
+    MapFileHeader header = {};
+    memcpy(header.magic, MAP_FILE_MAGIC, sizeof(MAP_FILE_MAGIC));
+    header.version = MAP_FILE_VERSION;
+    header.width = width;
+    header.height = height;
+    header.seed = seed;
+    header.nRooms = nRooms;
+
+    for (unsigned i = 0; i < nRooms; i++)
+        header.nSegments += getRoomSegments(i).size();
+
+    header.roomIdsOffset = alignOffset(sizeof(MapFileHeader));
+    header.statusesOffset = alignOffset(header.roomIdsOffset + nTiles * sizeof(int32_t));
+    header.roomSegmentBeginsOffset = alignOffset(header.statusesOffset + nTiles * sizeof(uint8_t));
+    header.segmentsOffset = alignOffset(header.roomSegmentBeginsOffset + (nRooms + 1) * sizeof(uint64_t));
+    header.fileSize = header.segmentsOffset + header.nSegments * sizeof(Point);
+
+    std::ofstream file(path, std::ios::binary | std::ios::trunc);
+    if (!file)
+    {
+        std::cerr << "Could not open file " << path << std::endl;
+        return false;
+    }
+
+    file.write((const char*)&header, sizeof(header));
+    writePadding(file, sizeof(header));
+
+    file.write((const char*)tiles.roomIds, nTiles * sizeof(int32_t));
+    writePadding(file, header.roomIdsOffset + nTiles * sizeof(int32_t));
+
+    file.write((const char*)tiles.statuses, nTiles * sizeof(uint8_t));
+    writePadding(file, header.statusesOffset + nTiles * sizeof(uint8_t));
+
+    uint64_t segmentBegin = 0;
+    for (unsigned i = 0; i < nRooms; i++)
+    {
+        file.write((const char*)&segmentBegin, sizeof(segmentBegin));
+        segmentBegin += getRoomSegments(i).size();
+    }
+    file.write((const char*)&segmentBegin, sizeof(segmentBegin));
+    writePadding(file, header.roomSegmentBeginsOffset + (nRooms + 1) * sizeof(uint64_t));
+
+    for (unsigned i = 0; i < nRooms; i++)
+    {
+        std::span<const Point> segments = getRoomSegments(i);
+        file.write((const char*)segments.data(), segments.size_bytes());
+    }
+
+    if (!file)
+    {
+        std::cerr << "Could not write map file " << path << std::endl;
+        return false;
+    }
+
+    return true;
+}
+
+bool MapGen::load(const std::string& path)
+{
+    // sections are used in place
+    if constexpr (std::endian::native != std::endian::little)
+    {
+        std::cerr << "Map files can only be loaded on little-endian machines" << std::endl;
+        return false;
+    }
+
+    std::shared_ptr<MappedFile> file(MappedFile::open(path));
+    if (!file)
+    {
+        std::cerr << "Could not open file " << path << std::endl;
+        return false;
+    }
+
+    MapFileHeader header;
+    if (file->size < sizeof(header))
+    {
+        std::cerr << "Map file " << path << " is too short" << std::endl;
+        return false;
+    }
+    memcpy(&header, file->data, sizeof(header));
+
+    if (memcmp(header.magic, MAP_FILE_MAGIC, sizeof(MAP_FILE_MAGIC)) != 0 || header.version != MAP_FILE_VERSION)
+    {
+        std::cerr << path << " is not a map file of version " << MAP_FILE_VERSION << std::endl;
+        return false;
+    }
+
+    uint64_t nTiles = (uint64_t)header.width * header.height;
+    bool isValid = header.fileSize == file->size && nTiles <= file->size && header.nRooms < file->size
+        && header.nSegments <= file->size
+        && isSectionInFile(header.roomIdsOffset, nTiles * sizeof(int32_t), file->size)
+        && isSectionInFile(header.statusesOffset, nTiles * sizeof(uint8_t), file->size)
+        && isSectionInFile(header.roomSegmentBeginsOffset, (header.nRooms + 1) * sizeof(uint64_t), file->size)
+        && isSectionInFile(header.segmentsOffset, header.nSegments * sizeof(Point), file->size);
+
+    const uint64_t* roomSegmentBegins = (const uint64_t*)(file->data + header.roomSegmentBeginsOffset);
+    const int32_t* roomIds = (const int32_t*)(file->data + header.roomIdsOffset);
+    const Point* segments = (const Point*)(file->data + header.segmentsOffset);
+
+    // the room graph indexes its arrays with the room ids and the rooms with their segments,
+    // so every one of them is checked before the map is used
+    for (uint64_t i = 0; isValid && i < nTiles; i++)
+        isValid = roomIds[i] >= -1 && roomIds[i] < (int64_t)header.nRooms;
+
+    isValid = isValid && roomSegmentBegins[0] == 0 && roomSegmentBegins[header.nRooms] == header.nSegments;
+    for (uint64_t i = 0; isValid && i < header.nRooms; i++)
+        isValid = roomSegmentBegins[i] <= roomSegmentBegins[i + 1];
+
+    for (uint64_t i = 0; isValid && i < header.nSegments; i++)
+    {
+        isValid = segments[i].x >= 0 && (uint32_t)segments[i].x < header.width
+            && segments[i].y >= 0 && (uint32_t)segments[i].y < header.height;
+    }
+
+    if (!isValid)
+    {
+        std::cerr << "Map file " << path << " is corrupted" << std::endl;
+        return false;
+    }
+
+    *this = MapGen(0, 0, header.seed);
+    width = header.width;
+    height = header.height;
+
+    tiles = TileStorage((int32_t*)(file->data + header.roomIdsOffset), file->data + header.statusesOffset, nTiles);
+
+    mapFile = file;
+    fileRoomSegmentBegins = roomSegmentBegins;
+    fileSegments = segments;
+    nFileRooms = header.nRooms;
+
+    return true;
+}
+
+bool MapGen::isLoaded()
+{
+    return mapFile != nullptr;
+}
@@ -0,0 +1,73 @@
+#pragma once
+
+#include <cstdint>
+#include <iosfwd>
+#include <string>
+
+// Binary map file, every value is little-endian.
+//
+//   MapFileHeader
+//   int32_t  roomIds[width * height]        -1 for tiles outside of rooms
+//   uint8_t  statuses[width * height]       TileAttrib bits
+//   uint64_t roomSegmentBegins[nRooms + 1]  room i owns segments [begin[i], begin[i + 1])
+//   int32_t  segments[nSegments][2]         x, y of every room tile
+//
+// Every section starts on a MAP_FILE_ALIGNMENT boundary, so the file can be mapped and
+// the sections used in place.
+
+#define MAP_FILE_MAGIC "PORTMAP"
+#define MAP_FILE_VERSION 1u
+#define MAP_FILE_ALIGNMENT 64u
+
+struct MapFileHeader
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t width;
+    uint32_t height;
+    uint32_t seed;
+
+    uint64_t nRooms;
+    uint64_t nSegments;
+
+    // byte offsets of the sections from the start of the file
+    uint64_t roomIdsOffset;
+    uint64_t statusesOffset;
+    uint64_t roomSegmentBeginsOffset;
+    uint64_t segmentsOffset;
+    uint64_t fileSize;
+};
+
+static_assert(sizeof(MapFileHeader) == 80, "the header layout is part of the file format");
+
+// Whole file mapped into memory copy-on-write, writes through data are never saved to the file
+class MappedFile
+{
+public:
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+    ~MappedFile();
+
+    // Returns nullptr if the file can not be mapped
+    static MappedFile* open(const std::string& path);
+
+    uint8_t* data = nullptr;
+    uint64_t size = 0;
+
+private:
+    MappedFile() {}
+
+#ifdef _WIN32
+    void* fileHandle = nullptr;
+    void* mappingHandle = nullptr;
+#endif
+};
+
+// Section helpers shared by the map and visibility files
+uint64_t alignOffset(uint64_t offset);
+bool isSectionInFile(uint64_t offset, uint64_t bytes, uint64_t fileSize);
+// Zeros up to the next aligned offset
+void writePadding(std::ostream& file, uint64_t offset);
+
+// 64-bit hash of the bytes continuing from hash, a word at a time
+uint64_t hashBytes(const void* data, uint64_t size, uint64_t hash = 0);
@@ -1,51 +1,89 @@
 #include "map_gen.hpp"
+#include "shape_table.hpp"
+
+#include <bit>
 
 #define COORD_ASSERT(x, y) assert(x < width); assert(y < height)
+#define MAP_EDGE_ID -2
+// below this many tiles updateWalls stays on one thread
+#define MIN_PARALLEL_WALL_TILES (1u << 16)
 
-MapGen::MapGen(unsigned width, unsigned height)
+MapGen::MapGen(unsigned width, unsigned height, unsigned seed)
 {
     this->width = width;
     this->height = height;
+    this->seed = seed;
+
+    rng = Pcg32(seed);
 
-    grid.resize(width * height);
+    tiles = TileStorage(width * height);
+    occupancy = OccupancyBitboard(width, height);
     shapes = RoomShapeFactory::getDefaultShapes();
 }
 
-MapGen::Tile& MapGen::getTile(unsigned x, unsigned y)
+MapGen::Tile MapGen::getTile(unsigned x, unsigned y)
 {
     COORD_ASSERT(x, y);
 
-    return grid[y * width + x];
+    return { tiles.roomIds[y * width + x], tiles.statuses[y * width + x] };
+}
+
+MapGen::Tile MapGen::getTileDirect(unsigned n)
+{
+    assert(n < tiles.size);
+
+    return { tiles.roomIds[n], tiles.statuses[n] };
+}
+
+size_t MapGen::getGridBytes()
+{
+    return tiles.size * (sizeof(int32_t) + sizeof(uint8_t));
 }
 
-MapGen::Tile& MapGen::getTileDirect(unsigned n)
+unsigned MapGen::getRoomCount()
 {
-    assert(n < grid.size());
+    return mapFile ? (unsigned)nFileRooms : rooms.size();
+}
 
-    return grid[n];
+std::span<const Point> MapGen::getRoomSegments(unsigned roomId)
+{
+    assert(roomId < getRoomCount());
+
+    if (!mapFile)
+        return rooms[roomId].segments;
+
+    uint64_t begin = fileRoomSegmentBegins[roomId];
+    return std::span<const Point>(fileSegments + begin, fileRoomSegmentBegins[roomId + 1] - begin);
 }
 
-int MapGen::getNewRoomId()
+MapGen::GenRegion MapGen::getFullRegion()
 {
-    return ++lastRoomId;
+    assert(!isLoaded());
+
+    GenRegion region;
+    region.scanEnd = height;
+    region.roomEnd = height;
+    region.firstRoomId = rooms.size();
+
+    return region;
 }
 
-void MapGen::addTileAttrib(Tile& tile, TileAttrib attrib)
+void MapGen::addTileAttrib(Tile tile, TileAttrib attrib)
 {
     tile.status |= (unsigned)attrib;
 }
 
-void MapGen::removeTileAttrib(Tile& tile, TileAttrib attrib)
+void MapGen::removeTileAttrib(Tile tile, TileAttrib attrib)
 {
     tile.status &= ~((unsigned)attrib);
 }
 
-bool MapGen::hasTileAttrib(Tile& tile, TileAttrib attrib)
+bool MapGen::hasTileAttrib(Tile tile, TileAttrib attrib)
 {
     return tile.status & (unsigned)attrib;
 }
 
-bool MapGen::isTileInRoom(Tile& tile)
+bool MapGen::isTileInRoom(Tile tile)
 {
     return !(tile.roomId == -1);
 }
@@ -61,8 +99,8 @@ bool MapGen::addDoor(TileAttrib doorAttrib, unsigned x, unsigned y)
     if (nX >= width || nY >= height)
         return false;
 
-    Tile& tile = getTile(x, y);
-    Tile& nTile = getTile(nX, nY);
+    Tile tile = getTile(x, y);
+    Tile nTile = getTile(nX, nY);
 
     if (!isTileInRoom(tile) || !isTileInRoom(nTile))
         return false;
@@ -76,15 +114,37 @@ bool MapGen::addDoor(TileAttrib doorAttrib, unsigned x, unsigned y)
     return true;
 }
 
-bool MapGen::placeRoom(RoomShape& room, bool addDoors)
+bool MapGen::removeDoor(TileAttrib doorAttrib, unsigned x, unsigned y)
 {
-    unsigned x = room.segments[0].x;
-    unsigned y = room.segments[0].y;
+    unsigned nX = x + otherTileOffsetFromDoorAttrib.at(doorAttrib).x;
+    unsigned nY = y + otherTileOffsetFromDoorAttrib.at(doorAttrib).y;
+
+    if (x >= width || y >= height)
+        return false;
 
-    Tile& startTile = getTile(x, y);
+    if (nX >= width || nY >= height)
+        return false;
+
+    Tile tile = getTile(x, y);
+    Tile nTile = getTile(nX, nY);
+
+    if (!hasTileAttrib(tile, doorAttrib))
+        return false;
+
+    removeTileAttrib(tile, doorAttrib);
+    removeTileAttrib(nTile, oppositeDoorAttrib.at(doorAttrib));
+
+    return true;
+}
+
+// rows outside the region belong to other regions generated at the same time, so they are
+// never read
+bool MapGen::fitsRoom(RoomShape& room, const GenRegion& region)
+{
+    Tile startTile = getTile(room.segments[0].x, room.segments[0].y);
     assert(!isTileInRoom(startTile));
 
-    for (int i = 1; i < room.segments.size(); i++)
+    for (int i = 1; i < (int)room.segments.size(); i++)
     {
         unsigned tileX = (unsigned)(room.segments[i].x);
         unsigned tileY = (unsigned)(room.segments[i].y);
@@ -92,113 +152,410 @@ bool MapGen::placeRoom(RoomShape& room, bool addDoors)
         if (tileX >= width || tileY >= height)
             return false;
 
-        Tile& tile = getTile(tileX, tileY);
+        if (tileY < region.roomBegin || tileY >= region.roomEnd)
+            return false;
+
+        Tile tile = getTile(tileX, tileY);
         if (isTileInRoom(tile))
             return false;
     }
 
-    int roomId = getNewRoomId();
-    rooms.push_back(room);
+    return true;
+}
+
+bool MapGen::placeRoom(RoomShape& room, bool addDoors)
+{
+    GenRegion region = getFullRegion();
+    if (!fitsRoom(room, region))
+        return false;
 
+    addRoom(room, addDoors, region);
+    rooms.push_back(region.rooms[0]);
+
+    unsigned top = room.segments[0].y;
+    unsigned bottom = room.segments[0].y;
     for (Point& seg : room.segments)
     {
-        Tile& tile = getTile(seg.x, seg.y);
-        tile.roomId = roomId;
+        top = min(top, (unsigned)seg.y);
+        bottom = max(bottom, (unsigned)seg.y);
     }
 
-    // Add walls
+    // the rows around the room get a wall towards it as well
+    updateWalls(top > 0 ? top - 1 : 0, min(bottom + 2, height));
+
+    return true;
+}
+
+static inline uint8_t getWallStatus(int32_t roomId, int32_t up, int32_t right, int32_t down, int32_t left, uint8_t status)
+{
+    uint8_t walls = (uint8_t)((up != roomId) | (right != roomId) << 1 | (down != roomId) << 2 | (left != roomId) << 3);
+
+    return roomId == -1 ? 0u : (uint8_t)((status & 0xF0u) | walls);
+}
+
+void MapGen::updateWalls(unsigned rowBegin, unsigned rowEnd)
+{
+    assert(rowBegin <= rowEnd && rowEnd <= height);
+
+    // neighbour ids outside of the map, never equal to a tile's id
+    vector<int32_t> outsideRow(width, MAP_EDGE_ID);
+
+    #pragma omp parallel for schedule(static) if((rowEnd - rowBegin) * width >= MIN_PARALLEL_WALL_TILES)
+    for (int y = rowBegin; y < (int)rowEnd; y++)
+    {
+        const int32_t* row = &tiles.roomIds[y * width];
+        const int32_t* up = y > 0 ? &tiles.roomIds[(y - 1) * width] : outsideRow.data();
+        const int32_t* down = y + 1 < (int)height ? &tiles.roomIds[(y + 1) * width] : outsideRow.data();
+        uint8_t* status = &tiles.statuses[y * width];
+        unsigned last = width - 1;
+
+        #pragma omp simd
+        for (unsigned x = 1; x < last; x++)
+        {
+            status[x] = getWallStatus(row[x], up[x], row[x + 1], down[x], row[x - 1], status[x]);
+        }
+
+        // first and last column have the map edge on one side
+        status[0] = getWallStatus(row[0], up[0], last > 0 ? row[1] : MAP_EDGE_ID, down[0], MAP_EDGE_ID, status[0]);
+        if (last > 0)
+            status[last] = getWallStatus(row[last], up[last], MAP_EDGE_ID, down[last], row[last - 1], status[last]);
+    }
+}
+
+void MapGen::addRoom(RoomShape& room, bool addDoors, GenRegion& region)
+{
+    unsigned x = room.segments[0].x;
+    unsigned y = room.segments[0].y;
+
+    int roomId = region.firstRoomId + region.rooms.size();
+    region.rooms.push_back(room);
+
+    // walls are added by updateWalls once the rooms around are known
     for (Point& seg : room.segments)
     {
+        Tile tile = getTile(seg.x, seg.y);
+        tile.roomId = roomId;
+        occupancy.set(seg.x, seg.y);
+    }
 
-        int tileX = seg.x;
-        int tileY = seg.y;
-        Tile& tile = getTile(seg.x, seg.y);
+    if (addDoors)
+    {
+        // add doors to adjacent room/rooms, the seam pass adds the ones leading out of a stripe
+        if (y > region.roomBegin || region.connectsUp)
+            addDoor(TileAttrib::DoorUp, x, y);
 
+        addDoor(TileAttrib::DoorLeft, x, y);
+    }
+}
 
-        for (int i = 0; i < directionsPacked.size() - 1; i++)
-        {
-            int nY = tileY + directionsPacked[i];
-            int nX = tileX + directionsPacked[i + 1];
+bool MapGen::constructRoom(unsigned x, unsigned y, Pcg32& rng, GenRegion& region)
+{
+    if (placement == Placement::FeasibleTable)
+        return constructFeasibleRoom(x, y, rng, region);
+
+    uint8_t availableShapes[N_SHAPES];
+    unsigned nAvailableShapes = N_SHAPES;
+
+    for (unsigned i = 0; i < N_SHAPES; i++)
+    {
+        availableShapes[i] = i;
+    }
+
+    while (nAvailableShapes > 0)
+    {
+        unsigned shapeId = rng.next() % nAvailableShapes;
+        unsigned shape = availableShapes[shapeId];
 
-            TileAttrib wallAttrib = (TileAttrib)(1u << i);
+        // unique configs of this shape which are already known not to fit
+        unsigned failedConfigs = 0;
 
-            if ((unsigned)nX < width && (unsigned)nY < height)
+        // configId picks from the configs 0..nAvailableConfigs-1, not from the configs
+        // which were not tried yet; both placements draw the same numbers this way and so
+        // produce the same maps
+        for (unsigned nAvailableConfigs = N_CONFIGS; nAvailableConfigs > 0; nAvailableConfigs--)
+        {
+            unsigned configId = rng.next() % nAvailableConfigs;
+
+            if (placement == Placement::Grid)
             {
-                Tile& neighbour = getTile(nX, nY);
-                if (neighbour.roomId != roomId)
-                    addTileAttrib(tile, wallAttrib);
+                RoomShape newRoom = shapes[shape].getConfig(configId);
+                newRoom.translate(x, y);
+
+                assert(newRoom.segments[0].x == (int)x);
+                assert(newRoom.segments[0].y == (int)y);
+
+                region.nPlacementTests++;
+
+                if (fitsRoom(newRoom, region))
+                {
+                    addRoom(newRoom, true, region);
+                    return true;
+                }
+
+                continue;
             }
-            else
+
+            const ShapeConfig& config = shapeTable[shape][configId];
+
+            if (failedConfigs & (1u << config.uniqueId))
+                continue;
+
+            region.nPlacementTests++;
+
+            bool isInRegion = (int)y + config.mask.minY >= (int)region.roomBegin && y + config.mask.maxY < region.roomEnd;
+
+            if (isInRegion && occupancy.fits(config.mask, x, y))
             {
-                addTileAttrib(tile, wallAttrib);
+                RoomShape newRoom(config, x, y);
+                addRoom(newRoom, true, region);
+                return true;
             }
+
+            failedConfigs |= 1u << config.uniqueId;
+        }
+
+        nAvailableShapes--;
+        for (unsigned i = shapeId; i < nAvailableShapes; i++)
+        {
+            availableShapes[i] = availableShapes[i + 1];
         }
     }
 
-    if (addDoors)
+    return false;
+}
+
+// Picks a shape among the ones with a config fitting at x, y and then one of its fitting
+// configs, found with one lookup per row of the window around the tile
+bool MapGen::constructFeasibleRoom(unsigned x, unsigned y, Pcg32& rng, GenRegion& region)
+{
+    region.nPlacementTests++;
+
+    uint8_t configs[N_SHAPES];
+    std::fill(std::begin(configs), std::end(configs), (uint8_t)0xFF);
+
+    for (unsigned row = 0; row < FEASIBLE_WINDOW; row++)
     {
-        // add doors to adjacent room/rooms
-        addDoor(TileAttrib::DoorUp, x, y);
-        addDoor(TileAttrib::DoorLeft, x, y);
+        int tileY = (int)y + (int)row - FEASIBLE_WINDOW_CENTER;
+
+        // rows outside of the region count as occupied
+        unsigned pattern = (1u << FEASIBLE_WINDOW) - 1;
+        if (tileY >= (int)region.roomBegin && tileY < (int)region.roomEnd)
+            pattern = (unsigned)occupancy.getRowAround(x, tileY, FEASIBLE_WINDOW_CENTER);
+
+        for (unsigned shape = 0; shape < N_SHAPES; shape++)
+            configs[shape] &= feasibleTable[row][pattern][shape];
     }
 
+    uint8_t feasibleShapes[N_SHAPES];
+    unsigned nFeasibleShapes = 0;
+
+    for (unsigned shape = 0; shape < N_SHAPES; shape++)
+    {
+        if (configs[shape] != 0)
+            feasibleShapes[nFeasibleShapes++] = shape;
+    }
+
+    if (nFeasibleShapes == 0)
+        return false;
+
+    unsigned shape = feasibleShapes[rng.next() % nFeasibleShapes];
+
+    // n-th set bit of the shape's configs
+    unsigned shapeConfigs = configs[shape];
+    for (unsigned n = rng.next() % std::popcount(shapeConfigs); n > 0; n--)
+        shapeConfigs &= shapeConfigs - 1;
+
+    RoomShape newRoom(shapeTable[shape][std::countr_zero(shapeConfigs)], x, y);
+    addRoom(newRoom, true, region);
+
     return true;
 }
 
-bool MapGen::constructRoom(unsigned x, unsigned y)
+void MapGen::generate()
 {
-    auto availableShapes = std::vector<RoomShape>(shapes.size());
+    GenRegion region = getFullRegion();
 
-    for (int i = 0; i < shapes.size(); i++)
+    if (placement != Placement::Grid)
     {
-        availableShapes[i] = shapes[i].deepCopy();
+        generateRegion(region, rng);
+    }
+    else
+    {
+        for (unsigned y = 0; y < height; y++)
+        {
+            for (unsigned x = 0; x < width; x++)
+            {
+                Tile tile = getTile(x, y);
+
+                if (isTileInRoom(tile))
+                    continue;
+
+                constructRoom(x, y, rng, region);
+            }
+        }
     }
 
-    while (availableShapes.size() > 0)
+    rooms.insert(rooms.end(), region.rooms.begin(), region.rooms.end());
+    nPlacementTests += region.nPlacementTests;
+
+    updateWalls(0, height);
+}
+
+void MapGen::generateRegion(GenRegion& region, Pcg32& rng)
+{
+    for (unsigned y = region.scanBegin; y < region.scanEnd; y++)
     {
-        int shapeId = rand() % availableShapes.size();
+        // tiles left free by a failed construction are skipped by starting past them
+        for (unsigned x = occupancy.findFirstFree(0, y); x < width; x = occupancy.findFirstFree(x + 1, y))
+        {
+            constructRoom(x, y, rng, region);
+        }
+    }
+}
 
-        auto availableConfigs = std::vector<int>(N_CONFIGS);
-        for (int i = 0; i < N_CONFIGS; i++)
+// add offset to room ids in [fromId, toId) found in the given rows
+void MapGen::relabelRooms(unsigned rowBegin, unsigned rowEnd, int fromId, int toId, int offset)
+{
+    for (unsigned i = rowBegin * width; i < rowEnd * width; i++)
+    {
+        if (tiles.roomIds[i] >= fromId && tiles.roomIds[i] < toId)
+            tiles.roomIds[i] += offset;
+    }
+}
+
+// The map is split into horizontal stripes filled in parallel, each with its own random
+// stream. The bottom SEAM_ROWS rows of every stripe are left free. The seams are then filled
+// in parallel as well, with rooms free to cross into the stripes around them.
+void MapGen::generateParallel(unsigned nThreads)
+{
+    assert(rooms.size() == 0 && !isLoaded());
+
+    nThreads = max(nThreads, 1u);
+    unsigned nStripes = max(min(nThreads * 4, height / MIN_STRIPE_HEIGHT), 1u);
+    unsigned nSeams = nStripes - 1;
+
+    vector<GenRegion> stripes(nStripes);
+    for (unsigned i = 0; i < nStripes; i++)
+    {
+        GenRegion& stripe = stripes[i];
+        stripe.roomBegin = stripe.scanBegin = (unsigned)((unsigned long long)height * i / nStripes);
+        stripe.roomEnd = stripe.scanEnd = (unsigned)((unsigned long long)height * (i + 1) / nStripes);
+
+        if (i + 1 < nStripes)
+            stripe.roomEnd = stripe.scanEnd = stripe.scanEnd - SEAM_ROWS;
+    }
+
+    // stripes number their rooms from 0, ids are made global after all stripes are done
+    #pragma omp parallel for schedule(dynamic, 1) num_threads(nThreads)
+    for (int i = 0; i < (int)nStripes; i++)
+    {
+        Pcg32 stripeRng(seed, i);
+        generateRegion(stripes[i], stripeRng);
+    }
+
+    int nStripeRooms = 0;
+    for (auto& stripe : stripes)
+    {
+        stripe.firstRoomId = nStripeRooms;
+        nStripeRooms += stripe.rooms.size();
+    }
+
+    #pragma omp parallel for schedule(dynamic, 1) num_threads(nThreads)
+    for (int i = 0; i < (int)nStripes; i++)
+    {
+        relabelRooms(stripes[i].roomBegin, stripes[i].roomEnd, 0, INT_MAX, stripes[i].firstRoomId);
+    }
+
+    // Seams cover 3 * SEAM_ROWS above the stripe border, where the stripes could not fill all
+    // tiles, and 2 * SEAM_ROWS below it; only tiles up to SEAM_ROWS below the border are scanned
+    // so that rooms never leave the seam. Seams are MIN_STRIPE_HEIGHT apart and never touch the
+    // same rows. Every seam gets an id range large enough for a room per scanned tile, the
+    // ranges are compacted afterwards.
+    const int seamIdRange = 4 * SEAM_ROWS * width;
+
+    vector<GenRegion> seams(nSeams);
+    for (unsigned i = 0; i < nSeams; i++)
+    {
+        unsigned border = stripes[i + 1].roomBegin;
+
+        GenRegion& seam = seams[i];
+        seam.roomBegin = seam.scanBegin = border - 3 * SEAM_ROWS;
+        seam.scanEnd = min(border + SEAM_ROWS, height);
+        seam.roomEnd = min(border + 2 * SEAM_ROWS, height);
+        seam.connectsUp = true;
+        seam.firstRoomId = nStripeRooms + i * seamIdRange;
+    }
+
+    #pragma omp parallel for schedule(dynamic, 1) num_threads(nThreads)
+    for (int i = 0; i < (int)nSeams; i++)
+    {
+        Pcg32 seamRng(seed, nStripes + i);
+        generateRegion(seams[i], seamRng);
+
+        // rooms of the stripes in the rows of the seam were placed before the seam rooms above
+        // and left of them, so they are connected to those only now, as are the rooms starting
+        // on the first row of a stripe
+        for (auto room = stripes[i].rooms.rbegin(); room != stripes[i].rooms.rend() && room->segments[0].y >= (int)seams[i].roomBegin; room++)
         {
-            availableConfigs[i] = i;
+            addDoor(TileAttrib::DoorUp, room->segments[0].x, room->segments[0].y);
+            addDoor(TileAttrib::DoorLeft, room->segments[0].x, room->segments[0].y);
         }
 
-        while (availableConfigs.size() > 0)
+        for (auto room = stripes[i + 1].rooms.begin(); room != stripes[i + 1].rooms.end() && room->segments[0].y < (int)seams[i].roomEnd; room++)
         {
-            int configId = rand() % availableConfigs.size();
-            RoomShape newRoom = availableShapes[shapeId].getConfig(configId);
-            newRoom.translate(x, y);
+            addDoor(TileAttrib::DoorUp, room->segments[0].x, room->segments[0].y);
+            addDoor(TileAttrib::DoorLeft, room->segments[0].x, room->segments[0].y);
+        }
+    }
 
-            assert(newRoom.segments[0].x == x);
-            assert(newRoom.segments[0].y == y);
+    vector<int> seamRanges(nSeams);
+    int nRooms = nStripeRooms;
+    for (unsigned i = 0; i < nSeams; i++)
+    {
+        seamRanges[i] = seams[i].firstRoomId;
+        seams[i].firstRoomId = nRooms;
+        nRooms += seams[i].rooms.size();
+    }
 
-            if (placeRoom(newRoom, true))
-                return true;
+    #pragma omp parallel for schedule(dynamic, 1) num_threads(nThreads)
+    for (int i = 0; i < (int)nSeams; i++)
+    {
+        int offset = seams[i].firstRoomId - seamRanges[i];
+        relabelRooms(seams[i].roomBegin, seams[i].roomEnd, seamRanges[i], seamRanges[i] + seamIdRange, offset);
+    }
 
-            availableConfigs.erase(availableConfigs.begin() + configId);
-        }
+    rooms.reserve(nRooms);
+    for (auto& stripe : stripes)
+    {
+        rooms.insert(rooms.end(), stripe.rooms.begin(), stripe.rooms.end());
+        nPlacementTests += stripe.nPlacementTests;
+    }
 
-        availableShapes.erase(availableShapes.begin() + shapeId);
+    for (auto& seam : seams)
+    {
+        rooms.insert(rooms.end(), seam.rooms.begin(), seam.rooms.end());
+        nPlacementTests += seam.nPlacementTests;
     }
 
-    return false;
+    updateWalls(0, height);
 }
 
-void MapGen::generate()
+vector<MapGen> MapGen::generateBatch(unsigned count, unsigned width, unsigned height, unsigned firstSeed, unsigned nThreads)
 {
-    for (unsigned y = 0; y < height; y++)
-    {
-        for (unsigned x = 0; x < width; x++)
-        {
-            Tile& tile = getTile(x, y);
+    vector<MapGen> maps;
+    maps.reserve(count);
 
-            if (isTileInRoom(tile))
-                continue;
+    for (unsigned i = 0; i < count; i++)
+        maps.emplace_back(width, height, firstSeed + i);
 
-            constructRoom(x, y);
-        }
+    // maps share no state, so each one is a single task
+    #pragma omp parallel for schedule(dynamic, 1) num_threads(max(nThreads, 1u))
+    for (int i = 0; i < (int)count; i++)
+    {
+        maps[i].generate();
     }
+
+    return maps;
 }
 
 bool MapGen::createCustom(std::vector<RoomShape> rooms)
@@ -211,3 +568,77 @@ bool MapGen::createCustom(std::vector<RoomShape> rooms)
 
     return true;
 }
+
+void MapGen::paste(MapGen& other, unsigned x, unsigned y)
+{
+    assert(x + other.width <= width && y + other.height <= height);
+
+    assert(!isLoaded());
+
+    int firstRoomId = rooms.size();
+
+    for (unsigned otherY = 0; otherY < other.height; otherY++)
+    {
+        for (unsigned otherX = 0; otherX < other.width; otherX++)
+        {
+            Tile otherTile = other.getTile(otherX, otherY);
+            Tile tile = getTile(x + otherX, y + otherY);
+
+            tile.status = otherTile.status;
+            tile.roomId = otherTile.roomId;
+
+            if (!isTileInRoom(otherTile))
+                continue;
+
+            tile.roomId += firstRoomId;
+            occupancy.set(x + otherX, y + otherY);
+        }
+    }
+
+    for (unsigned i = 0; i < other.getRoomCount(); i++)
+    {
+        std::span<const Point> segments = other.getRoomSegments(i);
+
+        rooms.push_back(RoomShape(vector<Point>(segments.begin(), segments.end())));
+        rooms.back().translate(x, y);
+    }
+}
+
+TileStorage::TileStorage()
+{
+}
+
+TileStorage::TileStorage(size_t size)
+{
+    ownedRoomIds.resize(size, -1);
+    ownedStatuses.resize(size, 0u);
+
+    roomIds = ownedRoomIds.data();
+    statuses = ownedStatuses.data();
+    this->size = size;
+}
+
+TileStorage::TileStorage(int32_t* roomIds, uint8_t* statuses, size_t size)
+{
+    this->roomIds = roomIds;
+    this->statuses = statuses;
+    this->size = size;
+}
+
+TileStorage::TileStorage(const TileStorage& other)
+{
+    ownedRoomIds.assign(other.roomIds, other.roomIds + other.size);
+    ownedStatuses.assign(other.statuses, other.statuses + other.size);
+
+    roomIds = ownedRoomIds.data();
+    statuses = ownedStatuses.data();
+    size = other.size;
+}
+
+TileStorage& TileStorage::operator=(const TileStorage& other)
+{
+    if (this != &other)
+        *this = TileStorage(other);
+
+    return *this;
+}
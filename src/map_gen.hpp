@@ -2,18 +2,31 @@
 
 #include <vector>
 #include <map>
+#include <cstdint>
 #include <assert.h>
 #include <cstdlib>
 #include <ctime>
 #include <algorithm>
 #include <format>
 #include <initializer_list>
+#include <array>
+#include <memory>
+#include <span>
+#include <string>
 
 #include <glm/glm.hpp>
 
 #include "cppgraphics.hpp"
+#include "pcg32.hpp"
+#include "map_file.hpp"
 
 #define N_CONFIGS 8
+#define N_SHAPES 10
+#define MAX_SHAPE_SEGMENTS 7
+
+// rows of the tallest shape, the stripes of parallel generation leave this many rows per seam
+#define SEAM_ROWS 4
+#define MIN_STRIPE_HEIGHT 32
 
 using namespace std;
 
@@ -59,12 +72,45 @@ private:
 
 };
 
+// Occupied tiles of a room shape in one config, relative to its first segment.
+// Every row of the bounding box is a bitmask with bit 0 at minX.
+struct ShapeMask
+{
+    int minX = 0;
+    int maxX = 0;
+    int minY = 0;
+    int maxY = 0;
+
+    uint8_t rows[4] = {};
+};
+
+// Shape as written in RoomShapeFactory, before recalculateOrigin
+struct ShapeDef
+{
+    uint8_t nSegments = 0;
+    int8_t segments[MAX_SHAPE_SEGMENTS][2] = {};
+};
+
+// Shape in one config, segments in the order RoomShape::getConfig produces them
+struct ShapeConfig
+{
+    uint8_t configId = 0;
+    // lowest config of the same shape that occupies the same tiles
+    uint8_t uniqueId = 0;
+    uint8_t nSegments = 0;
+    int8_t segments[MAX_SHAPE_SEGMENTS][2] = {};
+
+    ShapeMask mask;
+};
+
 class RoomShape
 {
 public:
     RoomShape();
     RoomShape(vector<Point> segments);
     RoomShape(initializer_list<Point> segments);
+    RoomShape(const ShapeDef& def);
+    RoomShape(const ShapeConfig& config, unsigned x, unsigned y);
 
     vector<Point> segments;
 
@@ -107,6 +153,20 @@ public:
         return shapes;
     }
 
+    constexpr static ShapeDef defs[N_SHAPES] =
+    {
+        { 4, { {0, 0}, {0, 1}, {0, 2}, {0, 3} } },                          // I
+        { 4, { {0, 0}, {0, 1}, {0, 2}, {1, 2} } },                          // L
+        { 4, { {0, 0}, {1, 0}, {0, 1}, {1, 1} } },                          // O
+        { 4, { {0, 0}, {1, 0}, {1, 1}, {2, 1} } },                          // z
+        { 5, { {0, 0}, {1, 0}, {1, 1}, {1, 2}, {2, 2} } },                  // Z
+        { 4, { {0, 0}, {1, 0}, {2, 0}, {1, 1} } },                          // T
+        { 7, { {0, 0}, {0, 1}, {0, 2}, {1, 2}, {2, 2}, {2, 1 }, {2, 0} } }, // U
+        { 5, { {0, 0}, {-1, 1},{0, 1}, {1, 1}, {0, 2} } },                  // X
+        { 5, { {0, 0}, {0, 1}, {1, 1}, {1, 2}, {2, 2} } },                  // W
+        { 7, { {0, 0}, {1, 0}, {2, 0}, {1, 1}, {0, 2}, {1, 2}, {2, 2} } }   // H
+    };
+
     const static RoomShape I;
     const static RoomShape L;
     const static RoomShape O;
@@ -119,17 +179,66 @@ public:
     const static RoomShape H;
 };
 
+// One bit per tile, set when the tile belongs to a room.
+// Each row starts on a new word, bits past the map width are always set.
+class OccupancyBitboard
+{
+public:
+    OccupancyBitboard();
+    OccupancyBitboard(unsigned width, unsigned height);
+
+    unsigned width = 0;
+    unsigned height = 0;
+    unsigned rowWords = 0;
+
+    void set(unsigned x, unsigned y);
+    bool isSet(unsigned x, unsigned y) const;
+    bool fits(const ShapeMask& mask, unsigned x, unsigned y) const;
+    unsigned findFirstFree(unsigned x, unsigned y) const;
+    // columns x - radius..x + radius of row y as bits 0..2 * radius, columns outside the map are set
+    uint64_t getRowAround(unsigned x, unsigned y, unsigned radius) const;
+
+private:
+    vector<uint64_t> words;
+
+    uint64_t getBits(unsigned x, unsigned y) const;
+};
+
+// Room ids and statuses of all tiles, either owned or pointing into a mapped map file
+class TileStorage
+{
+public:
+    TileStorage();
+    TileStorage(size_t size);
+    TileStorage(int32_t* roomIds, uint8_t* statuses, size_t size);
+
+    // copies always own their tiles
+    TileStorage(const TileStorage& other);
+    TileStorage(TileStorage&& other) = default;
+    TileStorage& operator=(const TileStorage& other);
+    TileStorage& operator=(TileStorage&& other) = default;
+
+    int32_t* roomIds = nullptr;
+    uint8_t* statuses = nullptr;
+    size_t size = 0;
+
+private:
+    vector<int32_t> ownedRoomIds;
+    vector<uint8_t> ownedStatuses;
+};
+
 class MapGen
 {
 public:
-    MapGen(unsigned width, unsigned height);
+    MapGen(unsigned width, unsigned height, unsigned seed = 0);
 
     unsigned width;
     unsigned height;
+    unsigned seed;
 
-    const vector<int> directionsPacked = { -1, 0, 1, 0 ,-1 };
+    inline static const vector<int> directionsPacked = { -1, 0, 1, 0 ,-1 };
 
-    const std::map<TileAttrib, glm::ivec2> otherTileOffsetFromDoorAttrib =
+    inline static const std::map<TileAttrib, glm::ivec2> otherTileOffsetFromDoorAttrib =
     {
         {TileAttrib::DoorUp, { 0, -1 }},
         {TileAttrib::DoorRight, { 1, 0 }},
@@ -137,7 +246,7 @@ public:
         {TileAttrib::DoorLeft, { -1, 0 }}
     };
 
-    const std::map < TileAttrib, TileAttrib> oppositeDoorAttrib =
+    inline static const std::map < TileAttrib, TileAttrib> oppositeDoorAttrib =
     {
         {TileAttrib::DoorUp, TileAttrib::DoorDown},
         {TileAttrib::DoorRight, TileAttrib::DoorLeft},
@@ -147,33 +256,80 @@ public:
 
     vector<RoomShape> rooms = {};
 
+    // How rooms are fitted at a free tile. Grid builds every RoomShape config and walks the
+    // tile grid, Bitboard tests the precomputed configs against the occupancy bitboard and
+    // produces the same maps. FeasibleTable looks up all configs fitting around the tile at
+    // once and picks one of them, its maps differ from the other two.
+    enum class Placement
+    {
+        Grid,
+        Bitboard,
+        FeasibleTable
+    };
+
+    Placement placement = Placement::FeasibleTable;
+
+    // fit tests, or table lookups, done by the generation
+    unsigned long long nPlacementTests = 0;
+
     void generate();
+    // Deterministic for the same seed and thread count, but not equal to generate()
+    void generateParallel(unsigned nThreads);
+
+    // Generates count maps in parallel, map i is seeded with firstSeed + i
+    static vector<MapGen> generateBatch(unsigned count, unsigned width, unsigned height, unsigned firstSeed, unsigned nThreads);
     bool createCustom(std::vector<RoomShape> rooms);
+    // Copies the other map's tiles and rooms with its top left tile at x, y
+    void paste(MapGen& other, unsigned x, unsigned y);
     bool addDoor(TileAttrib doorAttrib, unsigned x, unsigned y);
+    // Removes the door and its other side, returns false if there is no door
+    bool removeDoor(TileAttrib doorAttrib, unsigned x, unsigned y);
+    // Sets the wall bits of the rows from the room ids, walls separate tiles of different rooms
+    void updateWalls(unsigned rowBegin, unsigned rowEnd);
+
+    // Writes the map in the binary format described in map_file.hpp
+    bool save(const std::string& path);
+    // Replaces this map with the one in the file. The file is mapped and its tiles and rooms
+    // are used in place, rooms can not be added to a loaded map. Returns false for files whose
+    // sections do not fit or whose room ids or segments are outside of the map.
+    bool load(const std::string& path);
+    bool isLoaded();
+    // Hash of the size, room count and tiles, the same for a generated map and its saved file
+    uint64_t getContentHash();
+
+    // Rooms of both generated and loaded maps, loaded maps leave rooms empty
+    unsigned getRoomCount();
+    std::span<const Point> getRoomSegments(unsigned roomId);
 
     void drawScheme(double width);
+    // RGBA pixels of the columns x tiles from x, y in the colors of drawScheme, every tile is
+    // tileSize x tileSize pixels and pixel rows are columns * tileSize pixels long
+    void rasterizeScheme(unsigned x, unsigned y, unsigned columns, unsigned rows, unsigned tileSize, uint8_t* pixels);
+    // Writes the scheme as a binary PPM image without opening a window
+    bool saveScheme(const std::string& path, unsigned tileSize);
 
+    // Reference to one tile, room ids and statuses are stored in separate arrays
     struct Tile
     {
-        int roomId = -1;
-        unsigned status = 0u;
+        int32_t& roomId;
+        uint8_t& status;
     };
 
-    Tile& getTile(unsigned x, unsigned y);
-    Tile& getTileDirect(unsigned n);
-    bool isTileInRoom(Tile& tile);
-    void addTileAttrib(Tile& tile, TileAttrib attrib);
-    void removeTileAttrib(Tile& tile, TileAttrib attrib);
-    bool hasTileAttrib(Tile& tile, TileAttrib attrib);
+    Tile getTile(unsigned x, unsigned y);
+    Tile getTileDirect(unsigned n);
+    bool isTileInRoom(Tile tile);
+    void addTileAttrib(Tile tile, TileAttrib attrib);
+    void removeTileAttrib(Tile tile, TileAttrib attrib);
+    bool hasTileAttrib(Tile tile, TileAttrib attrib);
+    size_t getGridBytes();
 
 private:
     vector<RoomShape> shapes;
+    Pcg32 rng;
 
     double windowWidth = -1.;
     double windowHeight = -1.;
 
-    int lastRoomId = -1;
-
     struct
     {
         int defaultGrid = cg::Black;
@@ -182,13 +338,79 @@ private:
         int door = cg::Blue;
     } drawColors;
 
-    vector<Tile> grid;
+    // drawColors and the window background as RGBA for rasterizeScheme
+    struct
+    {
+        uint8_t background[4] = { 26, 26, 26, 255 };
+        uint8_t defaultGrid[4] = { 0, 0, 0, 255 };
+        uint8_t floor[4] = { 0, 128, 0, 255 };
+        uint8_t wall[4] = { 255, 255, 255, 255 };
+        uint8_t door[4] = { 0, 0, 255, 255 };
+    } schemeColors;
+
+    // 5 bytes per tile, -1 marks a tile outside of any room
+    TileStorage tiles;
+
+    // room tables of a loaded map, inside mapFile
+    std::shared_ptr<MappedFile> mapFile;
+    const uint64_t* fileRoomSegmentBegins = nullptr;
+    const Point* fileSegments = nullptr;
+    uint64_t nFileRooms = 0;
+    OccupancyBitboard occupancy;
+
+    // Part of the map generated on its own, rooms get ids from firstRoomId upwards
+    struct GenRegion
+    {
+        // rows searched for free tiles
+        unsigned scanBegin = 0;
+        unsigned scanEnd = 0;
+
+        // rows the rooms have to fit into, tiles outside are never read or written
+        unsigned roomBegin = 0;
+        unsigned roomEnd = 0;
+
+        // rows above roomBegin are finished, so rooms on the first row get their doors up
+        bool connectsUp = false;
+
+        int firstRoomId = 0;
+        vector<RoomShape> rooms;
+
+        unsigned long long nPlacementTests = 0;
+    };
 
-    int getNewRoomId();
+    GenRegion getFullRegion();
+    void generateRegion(GenRegion& region, Pcg32& rng);
+    void relabelRooms(unsigned rowBegin, unsigned rowEnd, int fromId, int toId, int offset);
 
-    bool constructRoom(unsigned x, unsigned y);
+    bool constructRoom(unsigned x, unsigned y, Pcg32& rng, GenRegion& region);
+    bool constructFeasibleRoom(unsigned x, unsigned y, Pcg32& rng, GenRegion& region);
+    bool fitsRoom(RoomShape& room, const GenRegion& region);
     bool placeRoom(RoomShape & room, bool addDoors = true);
+    void addRoom(RoomShape& room, bool addDoors, GenRegion& region);
+
+    // Part of the scheme window cached between frames, either a batch of lines built for
+    // one zoom or an image rasterized with one tile size into a buffer of the pixel pool
+    struct SchemeChunk
+    {
+        double batchZoom = 0.;
+        unsigned imageTileSize = 0;
+        int pixelsId = -1;
+    };
+
+    // Pixel buffers of the chunk images, for the small and the detailed tiles. cppgraphics
+    // keys the texture of an image by the address of its pixels, so the buffers are never
+    // freed or moved while the scheme is shown and a chunk taking over a buffer replaces the
+    // texture left by the chunk before it.
+    struct SchemePixels
+    {
+        vector<vector<uint8_t>> buffers[2];
+        // buffers no chunk holds
+        vector<unsigned> freeIds[2];
+    };
 
     void drawInit(double width);
-    void drawTile(unsigned x, unsigned y);
+    // Draws the tile with its top left corner at x1, y1 of the window
+    void drawTile(unsigned x, unsigned y, double x1, double y1, double tileSize);
+    void drawSchemeChunk(unsigned chunkId, SchemeChunk& chunk, SchemePixels& pixels, double zoom, double left, double top);
+    void releaseSchemeChunk(unsigned chunkId, SchemeChunk& chunk, SchemePixels& pixels);
 };
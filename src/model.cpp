@@ -52,6 +52,16 @@ void Model::glUpdateInstanceId()
     glBufferSubData(GL_ARRAY_BUFFER, 0, instanceIds.size() * sizeof(unsigned), instanceIds.data());
 }
 
+void Model::glUpdateInstanceMatrices(std::vector<glm::mat4>& instanceMatrices)
+{
+    this->instanceMatrices = instanceMatrices;
+    instanceIds = {};
+
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, glBuffers[(unsigned)GlBufferType::INSTANCE_MATRIX]);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, instanceMatrices.size() * sizeof(glm::mat4), instanceMatrices.data(), GL_STATIC_DRAW);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, ssboBinding, glBuffers[(unsigned)GlBufferType::INSTANCE_MATRIX]);
+}
+
 bool Model::processScene(const aiScene* scene)
 {
     meshes.resize(scene->mNumMeshes);
@@ -0,0 +1,118 @@
+#include "map_gen.hpp"
+
+#include <bit>
+
+#define WORD_BITS 64u
+
+OccupancyBitboard::OccupancyBitboard()
+{
+}
+
+OccupancyBitboard::OccupancyBitboard(unsigned width, unsigned height)
+{
+    this->width = width;
+    this->height = height;
+
+    rowWords = (width + WORD_BITS - 1) / WORD_BITS;
+    words.resize(rowWords * height);
+
+    // mark bits past the map width as occupied so that they are never reported free
+    unsigned usedBits = width % WORD_BITS;
+    if (usedBits == 0)
+        return;
+
+    uint64_t padding = ~((1ull << usedBits) - 1);
+    for (unsigned y = 0; y < height; y++)
+        words[y * rowWords + rowWords - 1] |= padding;
+}
+
+void OccupancyBitboard::set(unsigned x, unsigned y)
+{
+    assert(x < width && y < height);
+
+    words[y * rowWords + x / WORD_BITS] |= 1ull << (x % WORD_BITS);
+}
+
+bool OccupancyBitboard::isSet(unsigned x, unsigned y) const
+{
+    assert(x < width && y < height);
+
+    return words[y * rowWords + x / WORD_BITS] & (1ull << (x % WORD_BITS));
+}
+
+// 64 bits of row y starting at column x
+uint64_t OccupancyBitboard::getBits(unsigned x, unsigned y) const
+{
+    unsigned word = x / WORD_BITS;
+    unsigned shift = x % WORD_BITS;
+
+    const uint64_t* row = &words[y * rowWords];
+    uint64_t bits = row[word] >> shift;
+
+    if (shift != 0 && word + 1 < rowWords)
+        bits |= row[word + 1] << (WORD_BITS - shift);
+
+    return bits;
+}
+
+bool OccupancyBitboard::fits(const ShapeMask& mask, unsigned x, unsigned y) const
+{
+    int left = (int)x + mask.minX;
+    int right = (int)x + mask.maxX;
+    int top = (int)y + mask.minY;
+    int bottom = (int)y + mask.maxY;
+
+    if (left < 0 || top < 0 || right >= (int)width || bottom >= (int)height)
+        return false;
+
+    for (int row = top; row <= bottom; row++)
+    {
+        if (getBits(left, row) & mask.rows[row - top])
+            return false;
+    }
+
+    return true;
+}
+
+// first free column >= x in row y, width if the rest of the row is occupied
+unsigned OccupancyBitboard::findFirstFree(unsigned x, unsigned y) const
+{
+    assert(y < height);
+
+    if (x >= width)
+        return width;
+
+    const uint64_t* row = &words[y * rowWords];
+    unsigned word = x / WORD_BITS;
+
+    // treat the bits before x as occupied
+    uint64_t freeBits = ~row[word] & (~0ull << (x % WORD_BITS));
+
+    while (freeBits == 0)
+    {
+        if (++word == rowWords)
+            return width;
+
+        freeBits = ~row[word];
+    }
+
+    return word * WORD_BITS + std::countr_zero(freeBits);
+}
+
+uint64_t OccupancyBitboard::getRowAround(unsigned x, unsigned y, unsigned radius) const
+{
+    assert(x < width && y < height && radius < WORD_BITS / 2);
+
+    uint64_t bits;
+    if (x >= radius)
+        bits = getBits(x - radius, y);
+    else
+        bits = getBits(0, y) << (radius - x) | ((1ull << (radius - x)) - 1);
+
+    // bit i is column x - radius + i, getBits reads zeros past the last word of the row
+    unsigned inMap = width - x + radius;
+    if (inMap < WORD_BITS)
+        bits |= ~0ull << inMap;
+
+    return bits & ((1ull << (2 * radius + 1)) - 1);
+}
@@ -0,0 +1,33 @@
+#pragma once
+
+#include <cstdint>
+
+// PCG32 (XSH RR) generator, see https://www.pcg-random.org
+// Generators with the same seed and different streams give independent sequences.
+class Pcg32
+{
+public:
+    Pcg32(uint64_t seed = 0, uint64_t stream = 0)
+    {
+        state = 0u;
+        increment = (stream << 1u) | 1u;
+        next();
+        state += seed;
+        next();
+    }
+
+    uint32_t next()
+    {
+        uint64_t oldState = state;
+        state = oldState * 6364136223846793005ull + increment;
+
+        uint32_t xorShifted = (uint32_t)(((oldState >> 18u) ^ oldState) >> 27u);
+        uint32_t rotation = (uint32_t)(oldState >> 59u);
+
+        return (xorShifted >> rotation) | (xorShifted << ((-rotation) & 31u));
+    }
+
+private:
+    uint64_t state;
+    uint64_t increment;
+};
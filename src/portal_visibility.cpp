@@ -1,111 +1,27 @@
 #include "portal_visibility.hpp"
 
-bool Door::operator==(Door& other)
+#include <algorithm>
+#include <assert.h>
+#include <filesystem>
+#include <iomanip>
+#include <numeric>
+#include <omp.h>
+#include <sstream>
+
+// part of the cache key, raise it when the search starts finding other rooms
+#define VISIBILITY_SEARCH_VERSION 3u
+
+PortalVisibility::PortalVisibility(const RoomGraph* graph)
 {
-    return this->locations == other.locations && this->otherRoomId == other.otherRoomId;
+    this->graph = graph;
 }
 
-Room::Room(unsigned roomId)
-{
-    this->roomId = roomId;
-}
-
-TileAttrib rotateRight(TileAttrib wallAttrib)
-{
-    return wallAttrib == TileAttrib::WallLeft ? TileAttrib::WallUp : (TileAttrib)((unsigned)wallAttrib << 1u);
-}
-
-TileAttrib rotateLeft(TileAttrib wallAttrib)
-{
-    return wallAttrib == TileAttrib::WallUp ? TileAttrib::WallLeft : (TileAttrib)((unsigned)wallAttrib >> 1u);
-}
-
-PortalVisibility PortalVisibility::getFromMap(MapGen* map)
-{
-    PortalVisibility portal;
-
-    // Add corners and doors
-    for (unsigned i = 0; i < map->rooms.size(); i++)
-    {
-        int startX = map->rooms[i].segments[0].x;
-        int startY = map->rooms[i].segments[0].y;
-
-        Room newRoom(map->getTile(startX, startY).roomId);
-
-        TileAttrib wallDirection = TileAttrib::WallUp;
-
-        int x = startX;
-        int y = startY;
-
-        while (true)
-        {
-            MapGen::Tile& tile = map->getTile(x, y);
-
-            if (!map->hasTileAttrib(tile, wallDirection))
-            {
-                wallDirection = rotateLeft(wallDirection);
-
-                glm::vec2 newCorner = { x + portal.cornerOffsetFormWallAttrib.at(wallDirection).x, y + portal.cornerOffsetFormWallAttrib.at(wallDirection).y };
-                if (newRoom.corners.size() > 0 && newRoom.corners[0] == newCorner)
-                    break;
-
-                newRoom.corners.push_back(newCorner);
-
-                x += portal.tileOffsetFromWallAttrib.at(wallDirection).x;
-                y += portal.tileOffsetFromWallAttrib.at(wallDirection).y;
-
-                continue;
-            }
-
-            TileAttrib doorDirection = (TileAttrib)((unsigned)wallDirection << 4);
-
-            if (map->hasTileAttrib(tile, doorDirection))
-            {
-                Door newDoor;
-
-                newDoor.locations[0].x = x + portal.doorOffsetsFromDoorAttrib.at(doorDirection)[0].x;
-                newDoor.locations[0].y = y + portal.doorOffsetsFromDoorAttrib.at(doorDirection)[0].y;
-                newDoor.locations[1].x = x + portal.doorOffsetsFromDoorAttrib.at(doorDirection)[1].x;
-                newDoor.locations[1].y = y + portal.doorOffsetsFromDoorAttrib.at(doorDirection)[1].y;
-
-                MapGen::Tile& otherTile = map->getTile(x + portal.otherTileOffsetFromDoorAttrib.at(doorDirection).x, y + portal.otherTileOffsetFromDoorAttrib.at(doorDirection).y);
-                newDoor.otherRoomId = otherTile.roomId;
-                newDoor.doorType = doorDirection;
-
-                newRoom.doors.push_back(newDoor);
-            }
-
-
-            if (!map->hasTileAttrib(tile, rotateRight(wallDirection)))
-            {
-                x += portal.tileOffsetFromWallAttrib.at(wallDirection).x;
-                y += portal.tileOffsetFromWallAttrib.at(wallDirection).y;
-            }
-            else
-            {
-                glm::vec2 newCorner = { x + portal.cornerOffsetFormWallAttrib.at(wallDirection).x, y + portal.cornerOffsetFormWallAttrib.at(wallDirection).y };
-                if (newRoom.corners.size() > 0 && newRoom.corners[0] == newCorner)
-                    break;
-
-                newRoom.corners.push_back(newCorner);
-
-                wallDirection = rotateRight(wallDirection);
-            }
-        }
-
-        portal.rooms.push_back(newRoom);
-    }
-
-    portal.map = map;
-    return portal;
-}
-
-bool PortalVisibility::isVertical(glm::vec2& first, glm::vec2& second)
+bool PortalVisibility::isVertical(const glm::vec2& first, const glm::vec2& second)
 {
     return fabs(first.x - second.x) < eps;
 }
 
-bool PortalVisibility::isVertical(Door& door)
+bool PortalVisibility::isVertical(const Door& door)
 {
     return isVertical(door.locations[0], door.locations[1]);
 }
@@ -168,109 +84,202 @@ float PortalVisibility::extendVectorToPlane(float plane, glm::vec2& vecStart, gl
     return val;
 }
 
-bool PortalVisibility::isLineInCone(ViewConeOrTunnel& cone, std::vector<glm::vec2>& line, bool isVertical)
+// extendVectorToPlane without branches, so that loops of the batched tests vectorize
+static inline float extendToPlane(float plane, float startX, float startY, float vecX, float vecY, bool isVertical)
 {
-    std::vector<float> lineVals(2);
-    lineVals[0] = isVertical ? line[0].y : line[0].x;
-    lineVals[1] = isVertical ? line[1].y : line[1].x;
-    float plane = isVertical ? line[0].x : line[0].y;
+    float vecVal = isVertical ? vecX : vecY;
+    float vecValOther = isVertical ? vecY : vecX;
+    float vecStartCoord = isVertical ? startX : startY;
+    float vecStartOther = isVertical ? startY : startX;
 
-    bool isConeBaseVertical = this->isVertical(cone);
-    bool isLineVertical = isVertical;
+    float mult = (plane - vecStartCoord) / (vecVal + FLT_MIN);
+    float val = vecValOther * mult + vecStartOther;
 
-    bool fromVerToHor = isConeBaseVertical && !isLineVertical;
-    bool fromHorToVer = !isConeBaseVertical && isLineVertical;
+    float awayVal = val < 0 ? -INFINITY : INFINITY;
+    return mult < 0 ? awayVal : val;
+}
 
-    bool needsAlterCond = (fromVerToHor && ((cone.Vectors[0].x < 0 && cone.Vectors[0].y < 0) || (cone.Vectors[0].x > 0 && cone.Vectors[0].y > 0))) ||
-                          (fromHorToVer && ((cone.Vectors[0].x > 0 && cone.Vectors[0].y > 0) || (cone.Vectors[0].x < 0 && cone.Vectors[0].y < 0)));
+// The rays from the points of the cone through its entrance points stay between the two lines
+// through a point and an entrance point that leave the other point and entrance point on
+// different sides. The vectors of the borders are turned so that the inside is on their left.
+void PortalVisibility::getConeBorders(const ViewConeOrTunnel& cone, glm::vec2 points[2], glm::vec2 vectors[2])
+{
+    auto cross = [](const glm::vec2& a, const glm::vec2& b) { return a.x * b.y - a.y * b.x; };
 
-    const unsigned lineDims = 2;
-    for (unsigned i = 0; i < lineDims; i++)
+    glm::vec2 entrance[2] = { cone.Points[0] + cone.Vectors[0], cone.Points[1] + cone.Vectors[1] };
+    glm::vec2 vector = entrance[0] - cone.Points[0];
+    unsigned first = cross(vector, cone.Points[1] - cone.Points[0]) * cross(vector, entrance[1] - cone.Points[0]) > 0 ? 1 : 0;
+    glm::vec2 insidePoints[2] = { entrance[1 - first], entrance[first] };
+
+    points[0] = cone.Points[0];
+    points[1] = cone.Points[1];
+    vectors[0] = entrance[first] - points[0];
+    vectors[1] = entrance[1 - first] - points[1];
+
+    for (unsigned i = 0; i < 2; i++)
     {
-        float extendedVal = extendVectorToPlane(plane, cone.Points[i], cone.Vectors[i], isVertical);
+        float side = cross(vectors[i], insidePoints[i] - points[i]);
 
-        if (needsAlterCond && std::isinf(fabs(extendedVal)))
-            extendedVal *= -1;
+        // with the entrance on the border there is no side to reject
+        if (fabs(side) < eps * glm::length(vectors[i]))
+            vectors[i] = glm::vec2(0);
+        else if (side < 0)
+            vectors[i] = -vectors[i];
+    }
+}
 
-        if (!needsAlterCond && std::powf(-1, i) * extendedVal < std::powf(-1, i) * lineVals[i])
-            return false;
+// A line is outside the cone only if both of its ends are outside the same border
+bool PortalVisibility::isLineInCone(const ViewConeOrTunnel& cone, const std::vector<glm::vec2>& line)
+{
+    glm::vec2 points[2], vectors[2];
+    getConeBorders(cone, points, vectors);
+
+    for (unsigned i = 0; i < 2; i++)
+    {
+        float border = -eps * glm::length(vectors[i]);
+        glm::vec2 start = line[0] - points[i];
+        glm::vec2 end = line[1] - points[i];
 
-        if (needsAlterCond && std::powf(-1, i) * extendedVal > std::powf(-1, i) * lineVals[(i + 1) % lineDims])
+        if (vectors[i].x * start.y - vectors[i].y * start.x < border && vectors[i].x * end.y - vectors[i].y * end.x < border)
             return false;
     }
 
     return true;
 }
 
-PortalVisibility::ViewConeOrTunnel PortalVisibility::getExtendedConeToLine(ViewConeOrTunnel& old, std::vector<glm::vec2>& line, bool isVertical)
+// isLineInCone for a group of doors
+uint64_t PortalVisibility::getDoorsInCone(const ViewConeOrTunnel& cone, const RoomGraph::DoorArrays& doors, unsigned first)
 {
-    ViewConeOrTunnel newCone;
-    float plane = isVertical ? line[0].x : line[0].y;
+    unsigned count = min(64u, doors.size - first);
+
+    glm::vec2 points[2], vectors[2];
+    getConeBorders(cone, points, vectors);
+
+    float pointX0 = points[0].x, pointY0 = points[0].y, vectorX0 = vectors[0].x, vectorY0 = vectors[0].y;
+    float pointX1 = points[1].x, pointY1 = points[1].y, vectorX1 = vectors[1].x, vectorY1 = vectors[1].y;
+    float border0 = -eps * glm::length(vectors[0]);
+    float border1 = -eps * glm::length(vectors[1]);
 
-    glm::vec2 coneEnd;
+    const float* x0 = doors.x0 + first;
+    const float* y0 = doors.y0 + first;
+    const float* x1 = doors.x1 + first;
+    const float* y1 = doors.y1 + first;
 
-    const unsigned lineDims = 2;
-    for (unsigned i = 0; i < lineDims; i++)
+    uint8_t isInCone[64];
+
+    #pragma omp simd
+    for (unsigned i = 0; i < count; i++)
     {
-        newCone.Points[i] = old.Points[i];
-        newCone.Vectors[i] = line[(i + 1) % 2] - old.Points[i];
-
-        // TODO kdybych se citil moc fancy
-        // pravdepodobne to zase potrebuje alternativni podminku pro ty dva edgecasy :)
-        //float n = extendVectorToPlane(plane, old.borderPoints[i], old.borderVectors[i], isVertical);
-
-        //if ((std::powf(-1, i)) * n > std::powf(-1, i) * lineVals[(i + 1) % 2]) // is entire line in the cone?
-        //{
-        //    newCone.borderVectors[i] = line[(i + 1) % 2] - old.borderPoints[i];
-        //}
-        //else
-        //{
-        //    float x = isVertical ? line[0].x : n;
-        //    float y = isVertical ? n : line[0].y;
-        //    auto culledPoint = glm::vec2(x, y);
-        //    newCone.borderVectors[i] = culledPoint - old.borderPoints[i];
-        //}
+        float side00 = vectorX0 * (y0[i] - pointY0) - vectorY0 * (x0[i] - pointX0);
+        float side01 = vectorX0 * (y1[i] - pointY0) - vectorY0 * (x1[i] - pointX0);
+        float side10 = vectorX1 * (y0[i] - pointY1) - vectorY1 * (x0[i] - pointX1);
+        float side11 = vectorX1 * (y1[i] - pointY1) - vectorY1 * (x1[i] - pointX1);
+
+        bool isOutside0 = side00 < border0 && side01 < border0;
+        bool isOutside1 = side10 < border1 && side11 < border1;
+
+        isInCone[i] = !isOutside0 && !isOutside1;
     }
 
-    return newCone;
+    uint64_t mask = 0;
+    for (unsigned i = 0; i < count; i++)
+        mask |= (uint64_t)isInCone[i] << i;
+
+    return mask;
 }
 
-Door& PortalVisibility::getDoorFromOtherPerspective(Room& currentRoom, Door& door)
+// The point where a ray from a point of from through a point of through meets the plane
+// moves monotonically with either point, so the hits of the rays between the corners of from
+// and the ends of through bound all of them. Without a hit past through for every pair the
+// line is kept whole.
+bool PortalVisibility::clipLineToRays(std::span<const glm::vec2> from, const glm::vec2 through[2], glm::vec2& first, glm::vec2& second)
 {
+    bool isVertical = this->isVertical(first, second);
+    float plane = isVertical ? first.x : first.y;
+    float lineVals[2] = { isVertical ? first.y : first.x, isVertical ? second.y : second.x };
 
-    // TODO wrong, doesnt work with mutliple door between same rooms
-    // always returns the first
-    Room& neigbour = rooms[door.otherRoomId];
+    float hitMin = INFINITY;
+    float hitMax = -INFINITY;
+    float firstVecNormal = 0.f;
 
-    for (auto& nDoor : neigbour.doors)
+    for (unsigned i = 0; i < from.size() * 2; i++)
     {
-        if (nDoor.otherRoomId == currentRoom.roomId)
-            return nDoor;
+        glm::vec2 start = from[i / 2];
+        glm::vec2 vec = through[i % 2] - start;
+
+        float vecNormal = isVertical ? vec.x : vec.y;
+        float startNormal = isVertical ? start.x : start.y;
+        float throughNormal = isVertical ? through[i % 2].x : through[i % 2].y;
+
+        if (fabs(vecNormal) < eps || (i > 0 && (vecNormal < 0) != (firstVecNormal < 0)))
+            return true;
+
+        // the plane lies before the through end
+        if ((plane - throughNormal) / vecNormal < 0)
+            return true;
+
+        float mult = (plane - startNormal) / vecNormal;
+        float hit = isVertical ? start.y + vec.y * mult : start.x + vec.x * mult;
+
+        firstVecNormal = i == 0 ? vecNormal : firstVecNormal;
+        hitMin = min(hitMin, hit);
+        hitMax = max(hitMax, hit);
     }
 
-    throw "door is not part of the currentRoom";
+    float clippedMin = max(lineVals[0], hitMin);
+    float clippedMax = min(lineVals[1], hitMax);
+    if (clippedMax <= clippedMin)
+        return false;
+
+    first = isVertical ? glm::vec2(plane, clippedMin) : glm::vec2(clippedMin, plane);
+    second = isVertical ? glm::vec2(plane, clippedMax) : glm::vec2(clippedMax, plane);
+
+    return true;
 }
 
-bool PortalVisibility::isInBoundingBox(std::vector<glm::vec2>& boundingBox, std::vector<glm::vec2> corners)
+// Rays through every door on the way pass through the part of the next door inside the cone,
+// and they leave the initial door through the part of it seen through both of the last doors
+bool PortalVisibility::getExtendedConeToLine(const ConeStep& step, const Door& door, ConeStep& next, std::span<const glm::vec2> areaCorners)
 {
-    if (corners[0].x < boundingBox[0].x && corners[1].x < boundingBox[0].x)
+    next.entranceDoorId = graph->getDoorId(door);
+    next.entrance[0] = door.locations[0];
+    next.entrance[1] = door.locations[1];
+
+    if (!clipLineToRays(step.cone.Points, step.entrance, next.entrance[0], next.entrance[1]))
         return false;
 
-    if (corners[0].x > boundingBox[1].x && corners[1].x > boundingBox[1].x)
+    if (!areaCorners.empty() && !clipLineToRays(areaCorners, step.entrance, next.entrance[0], next.entrance[1]))
         return false;
 
-    if (corners[0].y < boundingBox[0].y && corners[1].y < boundingBox[0].y)
+    glm::vec2 source[2] = { step.cone.Points[0], step.cone.Points[1] };
+    if (!clipLineToRays(next.entrance, step.entrance, source[0], source[1]))
         return false;
 
-    if (corners[0].y > boundingBox[1].y && corners[1].y > boundingBox[1].y)
+    next.cone = getViewConeOrTunnel(source[0], source[1], next.entrance[0], next.entrance[1], false);
+
+    return true;
+}
+
+bool PortalVisibility::isInBoundingBox(const glm::vec2 boundingBox[2], const glm::vec2& first, const glm::vec2& second)
+{
+    if (first.x < boundingBox[0].x && second.x < boundingBox[0].x)
+        return false;
+
+    if (first.x > boundingBox[1].x && second.x > boundingBox[1].x)
+        return false;
+
+    if (first.y < boundingBox[0].y && second.y < boundingBox[0].y)
+        return false;
+
+    if (first.y > boundingBox[1].y && second.y > boundingBox[1].y)
         return false;
 
     return true;
 }
 
-bool PortalVisibility::hasWallDoor(Room& room, float wallPlane, glm::vec2 wallBorderVals, bool isWallVertical)
+bool PortalVisibility::hasWallDoor(unsigned roomId, float wallPlane, glm::vec2 wallBorderVals, bool isWallVertical)
 {
-    for (auto& door : room.doors)
+    for (auto& door : graph->getDoors(roomId))
     {
         bool isDoorVertical = isVertical(door);
 
@@ -296,8 +305,10 @@ bool PortalVisibility::hasWallDoor(Room& room, float wallPlane, glm::vec2 wallBo
     return false;
 }
 
-bool PortalVisibility::isWallBetweenDoors(Room& room, Door& first, Door& second)
+bool PortalVisibility::isWallBetweenDoors(unsigned roomId, const Door& first, const Door& second)
 {
+    std::span<const glm::vec2> corners = graph->getCorners(roomId);
+
     ViewConeOrTunnel tunnel = getViewConeOrTunnel(first.locations[0], first.locations[1], second.locations[0], second.locations[1], true);
 
     // shift vector back so that we can use extend without getting INF/-INF
@@ -311,24 +322,27 @@ bool PortalVisibility::isWallBetweenDoors(Room& room, Door& first, Door& second)
     bool isSecondVertical = isVertical(second);
     float secondPlane = isSecondVertical ? second.locations[0].x : second.locations[0].y;
 
-    std::vector<glm::vec2> boundingBox(2);
+    glm::vec2 boundingBox[2];
     boundingBox[0].x = min({ first.locations[0].x, first.locations[1].x, second.locations[0].x, second.locations[1].x });
     boundingBox[0].y = min({ first.locations[0].y, first.locations[1].y, second.locations[0].y, second.locations[1].y });
     boundingBox[1].x = max({ first.locations[0].x, first.locations[1].x, second.locations[0].x, second.locations[1].x });
     boundingBox[1].y = max({ first.locations[0].y, first.locations[1].y, second.locations[0].y, second.locations[1].y });
 
-    for (unsigned i = 0; i < room.corners.size(); i++)
+    if (useBatchedTests)
+        return isWallBetweenDoorsIndexed(roomId, tunnel, boundingBox, isFirstVertical, firstPlane, isSecondVertical, secondPlane);
+
+    for (unsigned i = 0; i < corners.size(); i++)
     {
-        unsigned nextId = (i + 1) % room.corners.size();
+        unsigned nextId = (i + 1) % corners.size();
 
-        if (!isInBoundingBox(boundingBox, { room.corners[i], room.corners[nextId] }))
+        if (!isInBoundingBox(boundingBox, corners[i], corners[nextId]))
             continue;
 
-        bool isVertical = this->isVertical(room.corners[i], room.corners[nextId]);
+        bool isVertical = this->isVertical(corners[i], corners[nextId]);
 
-        float firstVal = isVertical ? room.corners[i].y : room.corners[i].x;
-        float secondVal = isVertical ? room.corners[nextId].y : room.corners[nextId].x;
-        float plane = isVertical ? room.corners[i].x : room.corners[i].y;
+        float firstVal = isVertical ? corners[i].y : corners[i].x;
+        float secondVal = isVertical ? corners[nextId].y : corners[nextId].x;
+        float plane = isVertical ? corners[i].x : corners[i].y;
         
         // skip walls which contain the doors
         if (isVertical == isFirstVertical && firstPlane == plane)
@@ -341,7 +355,7 @@ bool PortalVisibility::isWallBetweenDoors(Room& room, Door& first, Door& second)
         borderVals[0] = min(firstVal, secondVal);
         borderVals[1] = max(firstVal, secondVal);
 
-        if (hasWallDoor(room, plane, borderVals, isVertical))
+        if (hasWallDoor(roomId, plane, borderVals, isVertical))
             continue;
 
         float n1 = extendVectorToPlane(plane, tunnel.Points[0], tunnel.Vectors[0], isVertical);
@@ -354,7 +368,44 @@ bool PortalVisibility::isWallBetweenDoors(Room& room, Door& first, Door& second)
     return false;
 }
 
-bool PortalVisibility::areDoorsInSamePlane(Door& first, Door& second)
+// The wall loop of isWallBetweenDoors over the wall index of the room, only walls with their
+// plane inside the bounding box are looked at
+bool PortalVisibility::isWallBetweenDoorsIndexed(unsigned roomId, const ViewConeOrTunnel& tunnel, const glm::vec2 boundingBox[2],
+    bool isFirstVertical, float firstPlane, bool isSecondVertical, float secondPlane)
+{
+    for (bool isVertical : { true, false })
+    {
+        std::span<const RoomGraph::Wall> walls = graph->getWalls(roomId, isVertical);
+
+        float planeMin = isVertical ? boundingBox[0].x : boundingBox[0].y;
+        float planeMax = isVertical ? boundingBox[1].x : boundingBox[1].y;
+        float borderMin = isVertical ? boundingBox[0].y : boundingBox[0].x;
+        float borderMax = isVertical ? boundingBox[1].y : boundingBox[1].x;
+
+        auto wall = std::lower_bound(walls.begin(), walls.end(), planeMin,
+            [](const RoomGraph::Wall& wall, float plane) { return wall.plane < plane; });
+
+        for (; wall != walls.end() && wall->plane <= planeMax; ++wall)
+        {
+            if (wall->hasDoor || wall->max < borderMin || wall->min > borderMax)
+                continue;
+
+            // skip walls which contain the doors
+            if ((isVertical == isFirstVertical && firstPlane == wall->plane) || (isVertical == isSecondVertical && secondPlane == wall->plane))
+                continue;
+
+            float n1 = extendToPlane(wall->plane, tunnel.Points[0].x, tunnel.Points[0].y, tunnel.Vectors[0].x, tunnel.Vectors[0].y, isVertical);
+            float n2 = extendToPlane(wall->plane, tunnel.Points[1].x, tunnel.Points[1].y, tunnel.Vectors[1].x, tunnel.Vectors[1].y, isVertical);
+
+            if (n1 > wall->min && n1 < wall->max && n2 > wall->min && n2 < wall->max)
+                return true;
+        }
+    }
+
+    return false;
+}
+
+bool PortalVisibility::areDoorsInSamePlane(const Door& first, const Door& second)
 {
     bool firstVertical = isVertical(first);
     bool secondVertical = isVertical(second);
@@ -367,69 +418,555 @@ bool PortalVisibility::areDoorsInSamePlane(Door& first, Door& second)
         first.locations[0].y == second.locations[0].y;
 }
 
-void PortalVisibility::addRoomsFromCone(std::unordered_set<unsigned>& visibleRooms, ViewConeOrTunnel& cone, Room& searchedRoom, Room& previousRoom, Door& entranceDoor, Door& initialDoor)
+// Depth first search in the same order as a recursion over the doors. The cone is clipped at
+// every door, so an entrance door only leads to the same rooms again if it was searched before
+// with a cone through wider parts of the initial and the entrance door.
+void PortalVisibility::addRoomsFromCone(ScratchSet& visibleRooms, SearchedDoors& searchedDoors, const ConeStep& firstStep, const Door& initialDoor, unsigned long long& nConeTests,
+    std::span<const glm::vec2> areaCorners, std::vector<ConeStep>* leftSteps, unsigned long long splitConeTests)
 {
-    for (auto& door : searchedRoom.doors)
+    std::vector<ConeStep> stack = { firstStep };
+
+    while (!stack.empty())
     {
-        if (door.otherRoomId == initialDoor.otherRoomId)
-            continue;
+        if (leftSteps && nConeTests >= splitConeTests)
+        {
+            leftSteps->insert(leftSteps->end(), stack.begin(), stack.end());
+            return;
+        }
 
-        if (door.otherRoomId == previousRoom.roomId)
-            continue;
+        ConeStep step = stack.back();
+        stack.pop_back();
 
-        if (isWallBetweenDoors(searchedRoom, entranceDoor, door))
+        if (memoizeCones && !searchedDoors.insert(step))
             continue;
 
-        bool isVertical = this->isVertical(door);
-        std::vector<glm::vec2> line = { door.locations[0], door.locations[1] };
+        const Door& entranceDoor = graph->getDoor(step.entranceDoorId);
+        unsigned searchedRoomId = entranceDoor.otherRoomId;
+        unsigned previousRoomId = entranceDoor.roomId;
+
+        visibleRooms.insert(searchedRoomId);
+
+        size_t firstNext = stack.size();
 
-        if (!isLineInCone(cone, line, isVertical))
+        std::span<const Door> doors = graph->getDoors(searchedRoomId);
+        RoomGraph::DoorArrays doorArrays = graph->getDoorArrays(searchedRoomId);
+        uint64_t inConeMask = 0;
+
+        for (unsigned i = 0; i < doors.size(); i++)
+        {
+            const Door& door = doors[i];
+
+            // the batched test runs before the walls, it is far cheaper than them
+            if (useBatchedTests && i % 64 == 0)
+                inConeMask = getDoorsInCone(step.cone, doorArrays, i);
+
+            if (door.otherRoomId == initialDoor.otherRoomId)
+                continue;
+
+            if (door.otherRoomId == previousRoomId)
+                continue;
+
+            if (useBatchedTests)
+            {
+                nConeTests++;
+                if (!(inConeMask & (1ull << (i % 64))) || isWallBetweenDoors(searchedRoomId, entranceDoor, door))
+                    continue;
+            }
+            else
+            {
+                if (isWallBetweenDoors(searchedRoomId, entranceDoor, door))
+                    continue;
+
+                std::vector<glm::vec2> line = { door.locations[0], door.locations[1] };
+
+                nConeTests++;
+                if (!isLineInCone(step.cone, line))
+                    continue;
+            }
+
+            ConeStep next;
+            if (!getExtendedConeToLine(step, door, next, areaCorners))
+                continue;
+
+            stack.push_back(next);
+        }
+
+        // the first door of the room is searched first
+        std::reverse(stack.begin() + firstNext, stack.end());
+    }
+}
+
+VisibilityMatrix PortalVisibility::getVisibilities()
+{
+    return getVisibilities(0, graph->getRoomCount());
+}
+
+// Blocks of rooms are searched as tasks. A task that ran out of cone tests leaves the steps it
+// did not search to tasks of their own, the searches from every door through every door of the
+// neighbour for the rest of the rooms of a block, so that a few blocks of rooms seeing far do
+// not keep one thread busy after the others ran out of blocks. Splitting only loses the
+// memoized cones between the parts.
+//
+// Dense rows of a part of the rooms would be as long as the part, so parts are compressed.
+VisibilityMatrix PortalVisibility::getVisibilities(unsigned firstRoomId, unsigned endRoomId)
+{
+    unsigned nRows = endRoomId - firstRoomId;
+    unsigned nBlocks = (nRows + VISIBILITY_BLOCK_ROOMS - 1) / VISIBILITY_BLOCK_ROOMS;
+
+    std::vector<unsigned> rowSizes(nRows);
+    std::vector<std::vector<unsigned>> blocks(nBlocks);
+    std::vector<std::unique_ptr<SearchThread>> threads(omp_get_max_threads());
+
+    #pragma omp parallel
+    {
+        threads[omp_get_thread_num()] = std::make_unique<SearchThread>(graph->getRoomCount(), graph->getDoorCount());
+
+        #pragma omp single
+        for (unsigned block = 0; block < nBlocks; block++)
+        {
+            #pragma omp task firstprivate(block) shared(rowSizes, blocks, threads)
+            {
+                SearchThread& thread = *threads[omp_get_thread_num()];
+                unsigned long long splitConeTests = thread.nConeTests + VISIBILITY_SPLIT_CONE_TESTS;
+                unsigned blockEnd = min((block + 1u) * VISIBILITY_BLOCK_ROOMS, nRows);
+                std::vector<SplitStep> splitSteps;
+
+                for (unsigned i = block * VISIBILITY_BLOCK_ROOMS; i < blockEnd; i++)
+                {
+                    addVisibleRooms(firstRoomId + i, thread.visibleRooms, thread.searchedDoors, thread.nConeTests, {}, splitSearches ? &splitSteps : nullptr, splitConeTests);
+
+                    std::sort(thread.visibleRooms.ids.begin(), thread.visibleRooms.ids.end());
+                    blocks[block].insert(blocks[block].end(), thread.visibleRooms.ids.begin(), thread.visibleRooms.ids.end());
+                    rowSizes[i] = thread.visibleRooms.ids.size();
+
+                    thread.visibleRooms.clear();
+                }
+
+                if (!splitSteps.empty())
+                    searchSplitSteps(splitSteps, threads);
+            }
+        }
+    }
+
+    // rooms found by the split steps join the rows of their rooms
+    std::vector<std::pair<unsigned, unsigned>> splitIds;
+    unsigned long long nConeTests = 0;
+
+    for (const auto& thread : threads)
+    {
+        if (!thread)
             continue;
 
-        ViewConeOrTunnel newCone = getViewConeOrTunnel(cone.Points[0], cone.Points[1], line[0], line[1], false);
+        splitIds.insert(splitIds.end(), thread->splitIds.begin(), thread->splitIds.end());
+        nConeTests += thread->nConeTests;
+    }
+
+    std::sort(splitIds.begin(), splitIds.end());
 
-        visibleRooms.insert(door.otherRoomId);
-        addRoomsFromCone(visibleRooms, newCone, rooms[door.otherRoomId], searchedRoom, door, initialDoor);
+    for (auto split = splitIds.begin(); split != splitIds.end();)
+    {
+        unsigned block = (split->first - firstRoomId) / VISIBILITY_BLOCK_ROOMS;
+        unsigned blockEnd = min((block + 1u) * VISIBILITY_BLOCK_ROOMS, nRows);
+        std::vector<unsigned> rows;
+        auto row = blocks[block].begin();
+
+        for (unsigned i = block * VISIBILITY_BLOCK_ROOMS; i < blockEnd; i++)
+        {
+            size_t rowBegin = rows.size();
+            rows.insert(rows.end(), row, row + rowSizes[i]);
+            row += rowSizes[i];
+
+            for (; split != splitIds.end() && split->first == firstRoomId + i; ++split)
+                rows.push_back(split->second);
+
+            std::sort(rows.begin() + rowBegin, rows.end());
+            rows.erase(std::unique(rows.begin() + rowBegin, rows.end()), rows.end());
+            rowSizes[i] = rows.size() - rowBegin;
+        }
+
+        blocks[block] = std::move(rows);
+    }
+
+    this->nConeTests = nConeTests;
+
+    bool isWholeMap = firstRoomId == 0 && endRoomId == graph->getRoomCount();
+    return VisibilityMatrix::fromRows(rowSizes, blocks, isWholeMap ? layout : VisibilityMatrix::Layout::Compressed);
+}
+
+// The steps left by a task go to two tasks of half of them each. The sets of a thread are only
+// used between task scheduling points, so a task never finds them holding another search.
+void PortalVisibility::searchSplitSteps(std::vector<SplitStep> steps, std::vector<std::unique_ptr<SearchThread>>& threads)
+{
+    #pragma omp task firstprivate(steps) shared(threads)
+    {
+        size_t nSearched = searchSteps(*threads[omp_get_thread_num()], steps);
+
+        if (nSearched < steps.size())
+        {
+            size_t middle = nSearched + (steps.size() - nSearched + 1) / 2;
+            searchSplitSteps(std::vector<SplitStep>(steps.begin() + nSearched, steps.begin() + middle), threads);
+
+            if (middle < steps.size())
+                searchSplitSteps(std::vector<SplitStep>(steps.begin() + middle, steps.end()), threads);
+        }
+    }
+}
+
+// Consecutive steps of the same room and initial door share the memoized cones, as the search
+// of the room would
+size_t PortalVisibility::searchSteps(SearchThread& thread, std::vector<SplitStep>& steps)
+{
+    unsigned long long splitConeTests = thread.nConeTests + VISIBILITY_SPLIT_CONE_TESTS;
+    std::vector<ConeStep> leftSteps;
+    size_t i = 0;
+
+    for (; i < steps.size() && thread.nConeTests < splitConeTests; i++)
+    {
+        SplitStep split = steps[i];
+
+        if (i == 0 || split.initialDoorId != steps[i - 1].initialDoorId || split.roomId != steps[i - 1].roomId)
+            thread.searchedDoors.clear();
+
+        addRoomsFromCone(thread.visibleRooms, thread.searchedDoors, split.step, graph->getDoor(split.initialDoorId), thread.nConeTests, {}, &leftSteps, splitConeTests);
+
+        for (const ConeStep& step : leftSteps)
+            steps.push_back({ step, split.roomId, split.initialDoorId });
+
+        leftSteps.clear();
+
+        // rooms are passed on once all of their steps here are searched
+        if (i + 1 == steps.size() || steps[i + 1].roomId != split.roomId || thread.nConeTests >= splitConeTests)
+        {
+            for (unsigned visibleId : thread.visibleRooms.ids)
+                thread.splitIds.push_back({ split.roomId, visibleId });
+
+            thread.visibleRooms.clear();
+        }
+    }
+
+    return i;
+}
+
+// A door is only read by searches that enter one of its rooms, so only the rows holding
+// either room can change
+std::vector<unsigned> PortalVisibility::updateVisibilities(VisibilityMatrix& visibilities, unsigned roomId, unsigned otherRoomId)
+{
+    unsigned nRooms = graph->getRoomCount();
+    std::vector<uint8_t> isAffected(nRooms, 0);
+
+    #pragma omp parallel for schedule(static)
+    for (int row = 0; row < (int)nRooms; row++)
+    {
+        bool isRowAffected = false;
+        visibilities.forEachVisible(row, [&](unsigned visibleId)
+        {
+            isRowAffected |= visibleId == roomId || visibleId == otherRoomId;
+        });
+
+        isAffected[row] = isRowAffected;
+    }
+
+    std::vector<unsigned> affectedRoomIds;
+    for (unsigned row = 0; row < nRooms; row++)
+    {
+        if (isAffected[row])
+            affectedRoomIds.push_back(row);
+    }
+
+    visibilities.setRows(affectedRoomIds, getRows(affectedRoomIds));
+
+    return affectedRoomIds;
+}
+
+std::vector<std::vector<unsigned>> PortalVisibility::getRows(const std::vector<unsigned>& roomIds)
+{
+    std::vector<std::unique_ptr<SearchThread>> threads;
+    return getRows(roomIds, threads);
+}
+
+std::vector<std::vector<unsigned>> PortalVisibility::getRows(const std::vector<unsigned>& roomIds, std::vector<std::unique_ptr<SearchThread>>& threads)
+{
+    std::vector<std::vector<unsigned>> rows(roomIds.size());
+    unsigned long long nConeTests = 0;
+
+    threads.resize(max((size_t)omp_get_max_threads(), threads.size()));
+
+    #pragma omp parallel reduction(+ : nConeTests)
+    {
+        std::unique_ptr<SearchThread>& thread = threads[omp_get_thread_num()];
+        if (!thread || thread->nRooms != graph->getRoomCount() || thread->nDoors != graph->getDoorCount())
+            thread = std::make_unique<SearchThread>(graph->getRoomCount(), graph->getDoorCount());
+
+        ScratchSet& visibleRooms = thread->visibleRooms;
+        SearchedDoors& searchedDoors = thread->searchedDoors;
+
+        #pragma omp for schedule(dynamic, 1)
+        for (int i = 0; i < (int)roomIds.size(); i++)
+        {
+            addVisibleRooms(roomIds[i], visibleRooms, searchedDoors, nConeTests);
+
+            std::sort(visibleRooms.ids.begin(), visibleRooms.ids.end());
+            rows[i] = visibleRooms.ids;
+
+            visibleRooms.clear();
+        }
+    }
+
+    this->nConeTests = nConeTests;
+
+    return rows;
+}
+
+void PortalVisibility::addVisibleRooms(unsigned roomId, ScratchSet& visibleRooms, SearchedDoors& searchedDoors, unsigned long long& nConeTests,
+    std::span<const glm::vec2> areaCorners, std::vector<SplitStep>* splitSteps, unsigned long long splitConeTests)
+{
+    std::vector<ConeStep> leftSteps;
+
+    visibleRooms.insert(roomId);
+
+    for (auto& door : graph->getDoors(roomId))
+    {
+        unsigned neighborRoomId = door.otherRoomId;
+        visibleRooms.insert(neighborRoomId);
+
+        // entrance doors searched from this initial door
+        searchedDoors.clear();
+
+        for (auto& neighborDoor : graph->getDoors(neighborRoomId))
+        {
+            if (neighborDoor.otherRoomId == roomId)
+                continue;
+
+            if (areDoorsInSamePlane(door, neighborDoor))
+                continue;
+
+            if (isWallBetweenDoors(neighborRoomId, door, neighborDoor))
+                continue;
+
+            ConeStep firstStep;
+            firstStep.entranceDoorId = graph->getDoorId(neighborDoor);
+            firstStep.entrance[0] = neighborDoor.locations[0];
+            firstStep.entrance[1] = neighborDoor.locations[1];
+
+            // from an area, only the part of the neighbor door seen through the door is searched
+            if (!areaCorners.empty() && !clipLineToRays(areaCorners, door.locations, firstStep.entrance[0], firstStep.entrance[1]))
+                continue;
+
+            firstStep.cone = getViewConeOrTunnel(door.locations[0], door.locations[1], firstStep.entrance[0], firstStep.entrance[1], false);
+
+            addRoomsFromCone(visibleRooms, searchedDoors, firstStep, door, nConeTests, areaCorners, splitSteps ? &leftSteps : nullptr, splitConeTests);
+
+            for (const ConeStep& step : leftSteps)
+                splitSteps->push_back({ step, roomId, graph->getDoorId(door) });
+
+            leftSteps.clear();
+        }
     }
 }
 
-std::vector<std::vector<unsigned>> PortalVisibility::getVisibilities()
+TileVisibility PortalVisibility::getTileVisibilities(const VisibilityMatrix& visibilities)
+{
+    std::vector<unsigned> roomIds(graph->getRoomCount());
+    std::iota(roomIds.begin(), roomIds.end(), 0u);
+
+    return TileVisibility::fromRooms(getRoomMasks(visibilities, roomIds));
+}
+
+void PortalVisibility::updateTileVisibilities(TileVisibility& tileVisibilities, const VisibilityMatrix& visibilities, const std::vector<unsigned>& roomIds)
 {
-    std::vector<std::vector<unsigned>> visibilities(rooms.size());
+    tileVisibilities.setRooms(roomIds, getRoomMasks(visibilities, roomIds));
+}
 
-    #pragma omp parallel for schedule(dynamic, 16)
-    for (int i = 0; i < rooms.size(); i++)
+std::vector<TileVisibility::RoomMasks> PortalVisibility::getRoomMasks(const VisibilityMatrix& visibilities, const std::vector<unsigned>& roomIds)
+{
+    std::vector<TileVisibility::RoomMasks> masks(roomIds.size());
+    unsigned long long nConeTests = 0;
+
+    #pragma omp parallel reduction(+ : nConeTests)
     {
-        std::unordered_set<unsigned> visibleRooms;
-        visibleRooms.insert(rooms[i].roomId);
+        ScratchSet visibleRooms(graph->getRoomCount());
+        SearchedDoors searchedDoors(graph->getDoorCount());
+        std::vector<unsigned> row;
+        std::vector<uint64_t> mask;
 
-        for (auto& door : rooms[i].doors)
+        #pragma omp for schedule(dynamic, VISIBILITY_BLOCK_ROOMS)
+        for (int i = 0; i < (int)roomIds.size(); i++)
         {
-            Room& neighborRoom = rooms[door.otherRoomId];
-            visibleRooms.insert(door.otherRoomId);
+            visibilities.getRow(roomIds[i], row);
+            unsigned maskWords = (row.size() + 63) / 64;
+            bool hasTooManyMasks = false;
 
-            for (auto& neighborDoor : neighborRoom.doors)
+            for (unsigned tileId : graph->getTiles(roomIds[i]))
             {
-                if (neighborDoor.otherRoomId == rooms[i].roomId)
-                    continue;
+                glm::vec2 corner = graph->getTileCorner(tileId);
+                glm::vec2 tileCorners[4] = { corner, corner + glm::vec2(1.f, 0.f), corner + glm::vec2(0.f, 1.f), corner + glm::vec2(1.f, 1.f) };
 
-                if (areDoorsInSamePlane(door, neighborDoor))
-                    continue;
+                addVisibleRooms(roomIds[i], visibleRooms, searchedDoors, nConeTests, tileCorners);
 
-                if (isWallBetweenDoors(neighborRoom, door, neighborDoor))
-                    continue;
+                // rooms the search of the whole room did not find are left out
+                mask.assign(maskWords, 0);
+                for (unsigned visibleId : visibleRooms.ids)
+                {
+                    auto entry = std::lower_bound(row.begin(), row.end(), visibleId);
+                    if (entry != row.end() && *entry == visibleId)
+                        mask[(entry - row.begin()) / 64] |= 1ull << ((entry - row.begin()) % 64);
+                }
 
-                ViewConeOrTunnel viewCone = getViewConeOrTunnel(door.locations[0], door.locations[1], neighborDoor.locations[0], neighborDoor.locations[1], false);
+                visibleRooms.clear();
 
-                Room& searchedRoom = rooms[neighborDoor.otherRoomId];
-                visibleRooms.insert(searchedRoom.roomId);
-                
-                addRoomsFromCone(visibleRooms, viewCone, searchedRoom, neighborRoom, neighborDoor, door);
+                // tiles seeing the same rooms share the mask
+                std::vector<uint64_t>& words = masks[i].words;
+                unsigned nMasks = words.size() / maskWords;
+
+                unsigned maskId = 0;
+                while (maskId < nMasks && !std::equal(mask.begin(), mask.end(), words.begin() + maskId * maskWords))
+                    maskId++;
+
+                if (maskId > UINT8_MAX)
+                {
+                    hasTooManyMasks = true;
+                    break;
+                }
+
+                if (maskId == nMasks)
+                    words.insert(words.end(), mask.begin(), mask.end());
+
+                masks[i].tileMaskIds.push_back(maskId);
+            }
+
+            // the ids do not reach the masks, every tile sees the whole row of the room
+            if (hasTooManyMasks)
+            {
+                masks[i].words.assign(maskWords, ~0ull);
+                if (row.size() % 64 != 0)
+                    masks[i].words.back() = (1ull << (row.size() % 64)) - 1;
+
+                masks[i].tileMaskIds.assign(graph->getTiles(roomIds[i]).size(), 0);
             }
         }
+    }
 
-        visibilities[i] = std::vector<unsigned>(visibleRooms.begin(), visibleRooms.end());
+    this->nConeTests = nConeTests;
+
+    return masks;
+}
+
+PortalVisibility::SearchThread::SearchThread(unsigned nRooms, unsigned nDoors) : nRooms(nRooms), nDoors(nDoors), visibleRooms(nRooms), searchedDoors(nDoors)
+{
+}
+
+PortalVisibility::ScratchSet::ScratchSet(unsigned bound)
+{
+    bits.resize((bound + 63) / 64);
+}
+
+bool PortalVisibility::ScratchSet::insert(unsigned id)
+{
+    uint64_t mask = 1ull << (id % 64);
+    if (bits[id / 64] & mask)
+        return false;
+
+    bits[id / 64] |= mask;
+    ids.push_back(id);
+
+    return true;
+}
+
+void PortalVisibility::ScratchSet::clear()
+{
+    for (unsigned id : ids)
+        bits[id / 64] = 0;
+
+    ids.clear();
+}
+
+// steps are only read for doors in the set, so they are left uninitialized and a search only
+// touches the memory of the doors it reaches
+PortalVisibility::SearchedDoors::SearchedDoors(unsigned nDoors) : doorIds(nDoors), steps(new ConeStep[nDoors])
+{
+}
+
+// Cones entering through the same door differ by the path they took, but every room seen
+// from parts of the doors is seen from any parts containing them
+bool PortalVisibility::SearchedDoors::insert(const ConeStep& step)
+{
+    ConeStep& searched = steps[step.entranceDoorId];
+
+    if (!doorIds.insert(step.entranceDoorId))
+    {
+        bool isCovered = glm::all(glm::greaterThanEqual(step.entrance[0], searched.entrance[0])) && glm::all(glm::lessThanEqual(step.entrance[1], searched.entrance[1]))
+            && glm::all(glm::greaterThanEqual(step.cone.Points[0], searched.cone.Points[0])) && glm::all(glm::lessThanEqual(step.cone.Points[1], searched.cone.Points[1]));
+
+        if (isCovered)
+            return false;
     }
 
+    searched = step;
+
+    return true;
+}
+
+void PortalVisibility::SearchedDoors::clear()
+{
+    doorIds.clear();
+}
+
+uint64_t PortalVisibility::getCacheKey(MapGen& map)
+{
+    float doorOffsets[2] = { RoomGraph::doorStartOffset, RoomGraph::doorEndOffset };
+    uint32_t searchVersion = VISIBILITY_SEARCH_VERSION;
+
+    uint64_t key = hashBytes(doorOffsets, sizeof(doorOffsets), map.getContentHash());
+    return hashBytes(&searchVersion, sizeof(searchVersion), key);
+}
+
+static std::filesystem::path getCachePath(uint64_t key, const std::string& directory)
+{
+    std::ostringstream fileName;
+    fileName << std::hex << std::setw(16) << std::setfill('0') << key << ".pvs";
+
+    return std::filesystem::path(directory) / fileName.str();
+}
+
+VisibilityMatrix PortalVisibility::getCachedVisibilities(MapGen& map, const std::string& directory)
+{
+    uint64_t key = getCacheKey(map);
+    std::filesystem::path path = getCachePath(key, directory);
+
+    VisibilityMatrix visibilities;
+    if (std::filesystem::exists(path) && visibilities.load(path.string(), key) && visibilities.getRoomCount() == graph->getRoomCount())
+    {
+        if (layout != VisibilityMatrix::Layout::Auto && layout != visibilities.getLayout())
+            return visibilities.withLayout(layout);
+
+        return visibilities;
+    }
+
+    visibilities = getVisibilities();
+    saveCached(visibilities, map, directory);
+
     return visibilities;
 }
+
+// written aside and renamed, so an interrupted write never leaves a file under the key
+bool PortalVisibility::saveCached(const VisibilityMatrix& visibilities, MapGen& map, const std::string& directory)
+{
+    uint64_t key = getCacheKey(map);
+    std::filesystem::path path = getCachePath(key, directory);
+
+    std::error_code error;
+    std::filesystem::create_directories(directory, error);
+
+    std::string writePath = path.string() + ".tmp";
+    if (!visibilities.save(writePath, key))
+        return false;
+
+    std::filesystem::rename(writePath, path, error);
+    if (error)
+    {
+        std::cerr << "Could not move " << writePath << " to " << path.string() << std::endl;
+        return false;
+    }
+
+    return true;
+}
@@ -2,43 +2,69 @@
 #include <cmath>
 #include <vector>
 #include <map>
-#include <unordered_set>
+#include <memory>
 #include <iostream>
 
 #include "glm/glm.hpp"
 
 #include "map_gen.hpp"
+#include "room_graph.hpp"
+#include "tile_visibility.hpp"
+#include "visibility_matrix.hpp"
 
-struct Door
-{
-    glm::vec2 locations[2]{};
-    unsigned otherRoomId;
-    TileAttrib doorType;
-
-    bool operator==(Door& other);
-};
-
-class Room
-{
-public:
-    Room(unsigned roomId);
-
-    unsigned roomId;
-    std::vector<glm::vec2> corners = {};
-
-    std::vector<Door> doors;
-};
+// rooms whose visibilities are searched as one task and stored as one block of rows
+#define VISIBILITY_BLOCK_ROOMS 64
+// cone tests a task of getVisibilities runs before it splits, a block takes a few thousand on average
+#define VISIBILITY_SPLIT_CONE_TESTS 8192
 
 class PortalVisibility
 {
 public:
-    static PortalVisibility getFromMap(MapGen* map);
-
-    std::vector<std::vector<unsigned>> getVisibilities();
+    PortalVisibility(const RoomGraph* graph);
+
+    VisibilityMatrix getVisibilities();
+    // Rows of the rooms from firstRoomId up to endRoomId, row i holding the rooms visible from
+    // room firstRoomId + i. Rows of a part of the rooms are always compressed.
+    VisibilityMatrix getVisibilities(unsigned firstRoomId, unsigned endRoomId);
+    // Loads the visibilities of the map from a file in the directory named by a hash of the
+    // map and the door offsets. Missing, stale or corrupted files are computed and written.
+    VisibilityMatrix getCachedVisibilities(MapGen& map, const std::string& directory);
+
+    // Key of the visibilities of the map in the cache, covering the map and the search
+    static uint64_t getCacheKey(MapGen& map);
+    // Writes the visibilities of the map to its file in the cache directory
+    static bool saveCached(const VisibilityMatrix& visibilities, MapGen& map, const std::string& directory);
+    // Recomputes the rows that can change when a door between the rooms is added or removed,
+    // after the graph was updated. Returns the rooms whose rows were recomputed.
+    std::vector<unsigned> updateVisibilities(VisibilityMatrix& visibilities, unsigned roomId, unsigned otherRoomId);
+    // Searches only the rows of the rooms, each sorted
+    std::vector<std::vector<unsigned>> getRows(const std::vector<unsigned>& roomIds);
+
+    // Rooms visible from every tile, searched from the tile's square instead of the whole room
+    TileVisibility getTileVisibilities(const VisibilityMatrix& visibilities);
+    // Recomputes the tiles of the rooms whose rows updateVisibilities recomputed
+    void updateTileVisibilities(TileVisibility& tileVisibilities, const VisibilityMatrix& visibilities, const std::vector<unsigned>& roomIds);
+
+    // skip entrance doors searched before from the initial door with a wider cone, without
+    // it the cones are searched again for every path of doors leading to them
+    bool memoizeCones = true;
+    // test a cone against all doors of a room at once and a tunnel only against the walls
+    // around it, the tests one door or wall at a time are kept to verify them
+    bool useBatchedTests = true;
+    // hand the steps a long task of getVisibilities did not search over to tasks any thread
+    // can take, without it a block of rooms is searched whole by one thread
+    bool splitSearches = true;
+    // doors tested against cones by the last getVisibilities or updateVisibilities
+    unsigned long long nConeTests = 0;
+    VisibilityMatrix::Layout layout = VisibilityMatrix::Layout::Auto;
 
 private:
-    std::vector<Room> rooms;
-    MapGen* map;
+    friend class Benchmarks;
+    friend class SectorVisibility;
+
+    using Door = RoomGraph::Door;
+
+    const RoomGraph* graph;
     const float eps = 1e-4f;
 
     struct ViewConeOrTunnel
@@ -47,55 +73,114 @@ private:
         glm::vec2 Points[2];
     };
 
-    const std::map<TileAttrib, glm::ivec2> cornerOffsetFormWallAttrib =
+    // Set of ids below a fixed bound, cleared in time proportional to its size. Each thread
+    // reuses one for the rooms and one for the doors it searches.
+    class ScratchSet
     {
-        {TileAttrib::WallUp, {1, 0}},
-        {TileAttrib::WallRight, {1, 1}},
-        {TileAttrib::WallDown, {0, 1}},
-        {TileAttrib::WallLeft, {0, 0}}
+    public:
+        ScratchSet(unsigned bound);
+
+        // ids in the order they were inserted
+        std::vector<unsigned> ids;
+
+        // Returns false if the id already was in the set
+        bool insert(unsigned id);
+        void clear();
+
+    private:
+        std::vector<uint64_t> bits;
     };
 
-    const std::map<TileAttrib, glm::ivec2> tileOffsetFromWallAttrib =
+    // Cone entering a room through the part of a door between the entrance points, waiting
+    // to be searched. The cone points are the part of the initial door it leaves from.
+    struct ConeStep
     {
-        {TileAttrib::WallUp, {1, 0}},
-        {TileAttrib::WallRight, {0, 1}},
-        {TileAttrib::WallDown, {-1, 0}},
-        {TileAttrib::WallLeft, {0, -1}}
+        ViewConeOrTunnel cone;
+        unsigned entranceDoorId;
+        glm::vec2 entrance[2];
     };
 
-    const float doorStartOffset = 0.35f;
-    const float doorEndOffset = 0.65f;
+    // Entrance doors searched from one initial door, with the last cone searched through
+    // every door
+    class SearchedDoors
+    {
+    public:
+        SearchedDoors(unsigned nDoors);
+
+        // Returns false if a cone through parts of both doors containing the ones of the
+        // step was already searched
+        bool insert(const ConeStep& step);
+        void clear();
 
-    const std::map<TileAttrib, std::vector<glm::vec2>> doorOffsetsFromDoorAttrib =
+    private:
+        ScratchSet doorIds;
+        std::unique_ptr<ConeStep[]> steps;
+    };
+
+    // Step left by a long task, with the room and initial door of its search
+    struct SplitStep
     {
-        {TileAttrib::DoorUp, {{doorStartOffset, 0.f}, {doorEndOffset, 0.f}} },
-        {TileAttrib::DoorRight, {{1.f, doorStartOffset}, {1.f, doorEndOffset}} },
-        {TileAttrib::DoorDown, {{doorStartOffset, 1.f}, {doorEndOffset, 1.f}} },
-        {TileAttrib::DoorLeft, {{0.f, doorStartOffset}, {0.f, doorEndOffset}} },
+        ConeStep step;
+        unsigned roomId;
+        unsigned initialDoorId;
     };
 
-    const std::map<TileAttrib, glm::ivec2> otherTileOffsetFromDoorAttrib =
+    // Sets reused by the tasks of one thread and the rooms found by its split steps
+    struct SearchThread
     {
-        {TileAttrib::DoorUp, { 0, -1 }},
-        {TileAttrib::DoorRight, { 1, 0 }},
-        {TileAttrib::DoorDown, { 0, 1 }},
-        {TileAttrib::DoorLeft, { -1, 0 }}
+        SearchThread(unsigned nRooms, unsigned nDoors);
+
+        // bounds of the sets, the graph the sets were made for
+        unsigned nRooms;
+        unsigned nDoors;
+        ScratchSet visibleRooms;
+        SearchedDoors searchedDoors;
+        unsigned long long nConeTests = 0;
+        // room of the search and found room
+        std::vector<std::pair<unsigned, unsigned>> splitIds;
     };
 
     float extendVectorToPlane(float plane, glm::vec2& vecStart, glm::vec2& vec, bool isVertical);
 
-    bool isVertical(glm::vec2& first, glm::vec2& second);
-    bool isVertical(Door& door);
+    bool isVertical(const glm::vec2& first, const glm::vec2& second);
+    bool isVertical(const Door& door);
     bool isVertical(ViewConeOrTunnel& coneOrTunnel);
-    bool isInBoundingBox(std::vector<glm::vec2>& boundingBox, std::vector<glm::vec2> corners);
-    bool hasWallDoor(Room& room, float wallPlane, glm::vec2 wallBorderVals, bool isWallVertical);
-    bool isWallBetweenDoors(Room& room, Door& first, Door& second);
-    bool areDoorsInSamePlane(Door& first, Door& second);
+    bool isInBoundingBox(const glm::vec2 boundingBox[2], const glm::vec2& first, const glm::vec2& second);
+    bool hasWallDoor(unsigned roomId, float wallPlane, glm::vec2 wallBorderVals, bool isWallVertical);
+    bool isWallBetweenDoors(unsigned roomId, const Door& first, const Door& second);
+    bool isWallBetweenDoorsIndexed(unsigned roomId, const ViewConeOrTunnel& tunnel, const glm::vec2 boundingBox[2],
+        bool isFirstVertical, float firstPlane, bool isSecondVertical, float secondPlane);
+    bool areDoorsInSamePlane(const Door& first, const Door& second);
+
+    // Inserts the rooms visible from the room into visibleRooms, or only the ones visible from
+    // the convex area with the corners if they are given. With splitSteps, the steps left once
+    // nConeTests reaches splitConeTests are added to it instead of being searched.
+    void addVisibleRooms(unsigned roomId, ScratchSet& visibleRooms, SearchedDoors& searchedDoors, unsigned long long& nConeTests,
+        std::span<const glm::vec2> areaCorners = {}, std::vector<SplitStep>* splitSteps = nullptr, unsigned long long splitConeTests = 0);
+    // Searches the steps as a task, which splits again the steps it leaves
+    void searchSplitSteps(std::vector<SplitStep> steps, std::vector<std::unique_ptr<SearchThread>>& threads);
+    // Searches the steps in order until the thread ran VISIBILITY_SPLIT_CONE_TESTS more cone
+    // tests, adding the steps their searches leave. The rooms found go to the split ids of the
+    // thread. Returns the number of searched steps.
+    size_t searchSteps(SearchThread& thread, std::vector<SplitStep>& steps);
+    // getRows with the sets of the threads kept in threads between calls, made again when the
+    // graph has other counts of rooms or doors
+    std::vector<std::vector<unsigned>> getRows(const std::vector<unsigned>& roomIds, std::vector<std::unique_ptr<SearchThread>>& threads);
+    std::vector<TileVisibility::RoomMasks> getRoomMasks(const VisibilityMatrix& visibilities, const std::vector<unsigned>& roomIds);
 
     ViewConeOrTunnel getViewConeOrTunnel(glm::vec2 fromFirst, glm::vec2 fromSecond, glm::vec2 toFirst, glm::vec2 toSecond, bool isTunnel);
-    void addRoomsFromCone(std::unordered_set<unsigned>& visibleRooms, ViewConeOrTunnel& cone, Room& searchedRoom, Room& previousRoom, Door& entranceDoor, Door& initialDoor);
-    Door& getDoorFromOtherPerspective(Room& currentRoom, Door& door);
-
-    ViewConeOrTunnel getExtendedConeToLine(ViewConeOrTunnel& old, std::vector<glm::vec2>& line, bool isVertical);
-    bool isLineInCone(ViewConeOrTunnel& cone, std::vector<glm::vec2>& line, bool isVertical);
+    // With leftSteps, stops once nConeTests reaches splitConeTests and leaves the waiting steps in it
+    void addRoomsFromCone(ScratchSet& visibleRooms, SearchedDoors& searchedDoors, const ConeStep& firstStep, const Door& initialDoor, unsigned long long& nConeTests,
+        std::span<const glm::vec2> areaCorners, std::vector<ConeStep>* leftSteps = nullptr, unsigned long long splitConeTests = 0);
+
+    // Shrinks the line to the part of it hit by rays from the from segment past the through
+    // segment. Returns false if no part is hit.
+    bool clipLineToRays(std::span<const glm::vec2> from, const glm::vec2 through[2], glm::vec2& first, glm::vec2& second);
+    // Makes the step entering through the part of the door inside the cone of the step.
+    // Returns false if no part of the door is inside.
+    bool getExtendedConeToLine(const ConeStep& step, const Door& door, ConeStep& next, std::span<const glm::vec2> areaCorners = {});
+    void getConeBorders(const ViewConeOrTunnel& cone, glm::vec2 points[2], glm::vec2 vectors[2]);
+    bool isLineInCone(const ViewConeOrTunnel& cone, const std::vector<glm::vec2>& line);
+    // Bit i is set if door first + i of the doors is in the cone, for up to 64 doors
+    uint64_t getDoorsInCone(const ViewConeOrTunnel& cone, const RoomGraph::DoorArrays& doors, unsigned first);
 };
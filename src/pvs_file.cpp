@@ -0,0 +1,177 @@
+#include "visibility_matrix.hpp"
+
+#include <bit>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <memory>
+
+#include "pvs_file.hpp"
+
+bool VisibilityMatrix::save(const std::string& path, uint64_t key) const
+{
+    // sections are written straight from memory
+    if constexpr (std::endian::native != std::endian::little)
+    {
+        std::cerr << "Visibility files can only be written on little-endian machines" << std::endl;
+        return false;
+    }
+
+    const void* sections[PVS_FILE_SECTIONS] = { rowBegins.data(), ids.data(), bits.data(), byteBegins.data(), bytes.data() };
+    const uint64_t elementSizes[PVS_FILE_SECTIONS] = { sizeof(uint64_t), sizeof(unsigned), sizeof(uint64_t), sizeof(uint64_t), sizeof(uint8_t) };
+
+    PvsFileHeader header = {};
+    memcpy(header.magic, PVS_FILE_MAGIC, sizeof(PVS_FILE_MAGIC));
+    header.version = PVS_FILE_VERSION;
+    header.layout = (uint32_t)layout;
+    header.key = key;
+    header.nRooms = nRooms;
+    header.rowWords = rowWords;
+    header.nVisible = nVisible;
+
+    header.sectionSizes[0] = rowBegins.size();
+    header.sectionSizes[1] = ids.size();
+    header.sectionSizes[2] = bits.size();
+    header.sectionSizes[3] = byteBegins.size();
+    header.sectionSizes[4] = bytes.size();
+
+    uint64_t offset = sizeof(PvsFileHeader);
+    for (unsigned i = 0; i < PVS_FILE_SECTIONS; i++)
+    {
+        header.sectionOffsets[i] = alignOffset(offset);
+        offset = header.sectionOffsets[i] + header.sectionSizes[i] * elementSizes[i];
+    }
+    header.fileSize = offset;
+
+    header.checksum = hashBytes(&header, sizeof(header));
+    for (unsigned i = 0; i < PVS_FILE_SECTIONS; i++)
+        header.checksum = hashBytes(sections[i], header.sectionSizes[i] * elementSizes[i], header.checksum);
+
+    std::ofstream file(path, std::ios::binary | std::ios::trunc);
+    if (!file)
+    {
+        std::cerr << "Could not open file " << path << std::endl;
+        return false;
+    }
+
+    file.write((const char*)&header, sizeof(header));
+    offset = sizeof(header);
+
+    for (unsigned i = 0; i < PVS_FILE_SECTIONS; i++)
+    {
+        writePadding(file, offset);
+        file.write((const char*)sections[i], header.sectionSizes[i] * elementSizes[i]);
+        offset = header.sectionOffsets[i] + header.sectionSizes[i] * elementSizes[i];
+    }
+
+    if (!file)
+    {
+        std::cerr << "Could not write visibility file " << path << std::endl;
+        return false;
+    }
+
+    return true;
+}
+
+bool VisibilityMatrix::load(const std::string& path, uint64_t key)
+{
+    if constexpr (std::endian::native != std::endian::little)
+    {
+        std::cerr << "Visibility files can only be loaded on little-endian machines" << std::endl;
+        return false;
+    }
+
+    std::unique_ptr<MappedFile> file(MappedFile::open(path));
+    if (!file)
+    {
+        std::cerr << "Could not open file " << path << std::endl;
+        return false;
+    }
+
+    PvsFileHeader header;
+    if (file->size < sizeof(header))
+    {
+        std::cerr << "Visibility file " << path << " is too short" << std::endl;
+        return false;
+    }
+    memcpy(&header, file->data, sizeof(header));
+
+    if (memcmp(header.magic, PVS_FILE_MAGIC, sizeof(PVS_FILE_MAGIC)) != 0 || header.version != PVS_FILE_VERSION || header.key != key)
+    {
+        std::cerr << path << " is not a visibility file of version " << PVS_FILE_VERSION << " for this map" << std::endl;
+        return false;
+    }
+
+    const uint64_t elementSizes[PVS_FILE_SECTIONS] = { sizeof(uint64_t), sizeof(unsigned), sizeof(uint64_t), sizeof(uint64_t), sizeof(uint8_t) };
+
+    bool isValid = header.fileSize == file->size && header.layout <= (uint32_t)Layout::Compressed && header.layout != (uint32_t)Layout::Auto;
+    for (unsigned i = 0; isValid && i < PVS_FILE_SECTIONS; i++)
+    {
+        isValid = header.sectionSizes[i] <= file->size
+            && isSectionInFile(header.sectionOffsets[i], header.sectionSizes[i] * elementSizes[i], file->size);
+    }
+
+    if (isValid)
+    {
+        PvsFileHeader checksumHeader = header;
+        checksumHeader.checksum = 0;
+
+        uint64_t checksum = hashBytes(&checksumHeader, sizeof(checksumHeader));
+        for (unsigned i = 0; i < PVS_FILE_SECTIONS; i++)
+            checksum = hashBytes(file->data + header.sectionOffsets[i], header.sectionSizes[i] * elementSizes[i], checksum);
+
+        isValid = checksum == header.checksum;
+    }
+
+    VisibilityMatrix loaded;
+    if (isValid)
+    {
+        auto section = [&](unsigned i) { return file->data + header.sectionOffsets[i]; };
+
+        loaded.nRooms = header.nRooms;
+        loaded.nVisible = header.nVisible;
+        loaded.layout = (Layout)header.layout;
+        loaded.rowWords = header.rowWords;
+
+        // the sections are read in place, the matrix keeps the file mapped
+        loaded.rowBegins.map((const uint64_t*)section(0), header.sectionSizes[0]);
+        loaded.ids.map((const unsigned*)section(1), header.sectionSizes[1]);
+        loaded.bits.map((const uint64_t*)section(2), header.sectionSizes[2]);
+        loaded.byteBegins.map((const uint64_t*)section(3), header.sectionSizes[3]);
+        loaded.bytes.map(section(4), header.sectionSizes[4]);
+        loaded.file = std::move(file);
+
+        isValid = loaded.hasValidSizes();
+    }
+
+    if (!isValid)
+    {
+        std::cerr << "Visibility file " << path << " is corrupted" << std::endl;
+        return false;
+    }
+
+    *this = std::move(loaded);
+
+    return true;
+}
+
+bool VisibilityMatrix::hasValidSizes() const
+{
+    if (rowWords != (nRooms + 63) / 64)
+        return false;
+
+    switch (layout)
+    {
+    case Layout::Dense:
+        return rowBegins.size() == (uint64_t)nRooms + 1 && rowBegins.front() == 0 && rowBegins.back() == nVisible
+            && ids.empty() && bits.size() == (uint64_t)nRooms * rowWords && byteBegins.empty() && bytes.empty();
+    case Layout::Sparse:
+        return rowBegins.size() == (uint64_t)nRooms + 1 && rowBegins.front() == 0 && rowBegins.back() == nVisible
+            && ids.size() == nVisible && bits.empty() && byteBegins.empty() && bytes.empty();
+    case Layout::Compressed:
+        return rowBegins.empty() && ids.empty() && bits.empty()
+            && byteBegins.size() == (uint64_t)nRooms + 1 && byteBegins.front() == 0 && byteBegins.back() == bytes.size();
+    default:
+        return false;
+    }
+}
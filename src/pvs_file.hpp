@@ -0,0 +1,43 @@
+#pragma once
+
+#include <cstdint>
+
+#include "map_file.hpp"
+
+// Binary visibility file, every value is little-endian.
+//
+//   PvsFileHeader
+//   uint64_t rowBegins[]   sparse and dense rows
+//   uint32_t ids[]         sparse rows
+//   uint64_t bits[]        dense rows
+//   uint64_t byteBegins[]  compressed rows
+//   uint8_t  bytes[]       compressed rows
+//
+// Sections the layout does not use are empty. Every section starts on a MAP_FILE_ALIGNMENT
+// boundary like in map files. The key identifies the map and search the visibilities were
+// computed for, the checksum covers the header and all sections.
+
+#define PVS_FILE_MAGIC "PORTPVS"
+#define PVS_FILE_VERSION 1u
+#define PVS_FILE_SECTIONS 5
+
+struct PvsFileHeader
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t layout;
+    uint64_t key;
+    // hash of the file with this field zero
+    uint64_t checksum;
+
+    uint32_t nRooms;
+    uint32_t rowWords;
+    uint64_t nVisible;
+
+    // byte offsets from the start of the file and element counts, in the order above
+    uint64_t sectionOffsets[PVS_FILE_SECTIONS];
+    uint64_t sectionSizes[PVS_FILE_SECTIONS];
+    uint64_t fileSize;
+};
+
+static_assert(sizeof(PvsFileHeader) == 136, "the header layout is part of the file format");
@@ -0,0 +1,241 @@
+#include "pvs_partition.hpp"
+
+#include <charconv>
+#include <chrono>
+#include <cstdlib>
+#include <filesystem>
+#include <iostream>
+#include <omp.h>
+#include <thread>
+
+#include "map_file.hpp"
+#include "portal_visibility.hpp"
+#include "room_graph.hpp"
+#include "visibility_matrix.hpp"
+
+int PvsPartition::run(const std::string& executable, std::vector<std::string> args)
+{
+    std::string cacheDirectory = "pvs_cache";
+    std::string partPath;
+    std::vector<std::string> positional;
+
+    for (unsigned i = 1; i < args.size(); i++)
+    {
+        if (args[i] == "--pvs-cache" && i + 1 < args.size())
+            cacheDirectory = args[++i];
+        else if (args[i] == "--pvs-out" && i + 1 < args.size())
+            partPath = args[++i];
+        else if (args[i] == "--threads" && i + 1 < args.size())
+        {
+            unsigned nThreads;
+            if (!parseCount(args[++i], nThreads) || nThreads == 0)
+            {
+                std::cerr << "Thread count " << args[i] << " is not a positive number" << std::endl;
+                return 1;
+            }
+
+            omp_set_num_threads(nThreads);
+        }
+        else
+            positional.push_back(args[i]);
+    }
+
+    if (args[0] == "--pvs-range" && positional.size() == 2)
+    {
+        // A:B
+        size_t colon = positional[0].find(':');
+        unsigned firstRoomId, endRoomId;
+
+        if (colon == std::string::npos || !parseCount(positional[0].substr(0, colon), firstRoomId)
+            || !parseCount(positional[0].substr(colon + 1), endRoomId))
+        {
+            std::cerr << "Room range " << positional[0] << " is not first:end" << std::endl;
+            return 1;
+        }
+
+        if (partPath.empty())
+            partPath = getPartPath(positional[1], firstRoomId, endRoomId);
+
+        return computeRange(positional[1], firstRoomId, endRoomId, partPath);
+    }
+
+    if (args[0] == "--pvs-merge" && positional.size() >= 2)
+        return merge(positional[0], std::vector<std::string>(positional.begin() + 1, positional.end()), cacheDirectory);
+
+    if (args[0] == "--pvs-workers" && positional.size() == 2)
+    {
+        unsigned nWorkers;
+        if (!parseCount(positional[0], nWorkers) || nWorkers == 0)
+        {
+            std::cerr << "Worker count " << positional[0] << " is not a positive number" << std::endl;
+            return 1;
+        }
+
+        return runWorkers(executable, positional[1], nWorkers, cacheDirectory);
+    }
+
+    std::cerr << "usage: portals --pvs-range first:end map [--pvs-out path] [--threads n]" << std::endl
+        << "       portals --pvs-merge map part... [--pvs-cache directory]" << std::endl
+        << "       portals --pvs-workers n map [--pvs-cache directory]" << std::endl;
+    return 1;
+}
+
+int PvsPartition::computeRange(const std::string& mapPath, unsigned firstRoomId, unsigned endRoomId, const std::string& partPath)
+{
+    MapGen map(0, 0);
+    if (!map.load(mapPath))
+        return 1;
+
+    if (firstRoomId >= endRoomId || endRoomId > map.getRoomCount())
+    {
+        std::cerr << "Room range " << firstRoomId << ":" << endRoomId << " is not inside the "
+            << map.getRoomCount() << " rooms of " << mapPath << std::endl;
+        return 1;
+    }
+
+    auto start = std::chrono::steady_clock::now();
+
+    RoomGraph graph = RoomGraph::build(map);
+    PortalVisibility portal(&graph);
+    VisibilityMatrix rows = portal.getVisibilities(firstRoomId, endRoomId);
+
+    if (!rows.save(partPath, getPartKey(map, firstRoomId)))
+        return 1;
+
+    double time = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    std::cout << "Rooms " << firstRoomId << ":" << endRoomId << " searched in " << time << " s, written to " << partPath << std::endl;
+
+    return 0;
+}
+
+int PvsPartition::merge(const std::string& mapPath, const std::vector<std::string>& partPaths, const std::string& cacheDirectory)
+{
+    MapGen map(0, 0);
+    if (!map.load(mapPath))
+        return 1;
+
+    // every part has to start where the one before it ended
+    std::vector<VisibilityMatrix> parts(partPaths.size());
+    unsigned firstRoomId = 0;
+
+    for (size_t i = 0; i < partPaths.size(); i++)
+    {
+        if (!parts[i].load(partPaths[i], getPartKey(map, firstRoomId)))
+        {
+            std::cerr << partPaths[i] << " is not the part of " << mapPath << " starting at room " << firstRoomId << std::endl;
+            return 1;
+        }
+
+        firstRoomId += parts[i].getRoomCount();
+    }
+
+    if (firstRoomId != map.getRoomCount())
+    {
+        std::cerr << "The parts cover " << firstRoomId << " of the " << map.getRoomCount() << " rooms of " << mapPath << std::endl;
+        return 1;
+    }
+
+    VisibilityMatrix visibilities = VisibilityMatrix::fromRanges(parts);
+    if (!PortalVisibility::saveCached(visibilities, map, cacheDirectory))
+        return 1;
+
+    std::cout << "Merged " << parts.size() << " parts, " << visibilities.getVisibleCount() << " visible rooms, into "
+        << cacheDirectory << std::endl;
+
+    return 0;
+}
+
+int PvsPartition::runWorkers(const std::string& executable, const std::string& mapPath, unsigned nWorkers, const std::string& cacheDirectory)
+{
+    MapGen map(0, 0);
+    if (!map.load(mapPath))
+        return 1;
+
+    unsigned nRooms = map.getRoomCount();
+
+    // a worker needs at least one room to search
+    if (nRooms == 0)
+    {
+        if (!PortalVisibility::saveCached(VisibilityMatrix::fromRows({}, {}), map, cacheDirectory))
+            return 1;
+
+        std::cout << mapPath << " has no rooms, wrote empty visibilities into " << cacheDirectory << std::endl;
+        return 0;
+    }
+
+    nWorkers = std::min(nWorkers, nRooms);
+
+    // the workers share the cores of this machine
+    unsigned nThreads = std::max(1u, std::thread::hardware_concurrency() / nWorkers);
+
+    std::vector<std::string> partPaths(nWorkers);
+    std::vector<int> results(nWorkers);
+    std::vector<std::thread> workers;
+
+    auto start = std::chrono::steady_clock::now();
+
+    for (unsigned i = 0; i < nWorkers; i++)
+    {
+        unsigned firstRoomId = (unsigned)((unsigned long long)nRooms * i / nWorkers);
+        unsigned endRoomId = (unsigned)((unsigned long long)nRooms * (i + 1) / nWorkers);
+        partPaths[i] = getPartPath(mapPath, firstRoomId, endRoomId);
+
+        std::string command = "\"" + executable + "\" --pvs-range " + std::to_string(firstRoomId) + ":" + std::to_string(endRoomId)
+            + " \"" + mapPath + "\" --pvs-out \"" + partPaths[i] + "\" --threads " + std::to_string(nThreads);
+
+#ifdef _WIN32
+        // cmd strips the outer quotes of the command
+        command = "\"" + command + "\"";
+#endif
+
+        workers.emplace_back([&results, i, command]() { results[i] = std::system(command.c_str()); });
+    }
+
+    for (auto& worker : workers)
+        worker.join();
+
+    double workersTime = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    int result = 0;
+    for (unsigned i = 0; i < nWorkers; i++)
+    {
+        if (results[i] != 0)
+        {
+            std::cerr << "Worker " << i << " failed with " << results[i] << std::endl;
+            result = 1;
+        }
+    }
+
+    if (result == 0)
+        result = merge(mapPath, partPaths, cacheDirectory);
+
+    std::error_code error;
+    for (const auto& partPath : partPaths)
+        std::filesystem::remove(partPath, error);
+
+    double time = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    std::cout << nWorkers << " workers of " << nThreads << " threads: " << workersTime << " s, with the merge "
+        << time << " s" << std::endl;
+
+    return result;
+}
+
+std::string PvsPartition::getPartPath(const std::string& mapPath, unsigned firstRoomId, unsigned endRoomId)
+{
+    return mapPath + "." + std::to_string(firstRoomId) + "-" + std::to_string(endRoomId) + ".pvs";
+}
+
+// The whole text as a number, unlike std::stoul which throws on bad input and ignores what
+// follows the digits
+bool PvsPartition::parseCount(const std::string& text, unsigned& value)
+{
+    const char* end = text.data() + text.size();
+    auto [last, error] = std::from_chars(text.data(), end, value);
+
+    return !text.empty() && error == std::errc() && last == end;
+}
+
+uint64_t PvsPartition::getPartKey(MapGen& map, unsigned firstRoomId)
+{
+    return hashBytes(&firstRoomId, sizeof(firstRoomId), PortalVisibility::getCacheKey(map));
+}
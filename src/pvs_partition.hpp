@@ -0,0 +1,35 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "map_gen.hpp"
+
+// Visibilities of a map file computed by separate processes, each searching the rows of a
+// range of rooms into a part file, and merged into the visibility cache of the map:
+//
+//   portals --pvs-range A:B map.bin [--pvs-out path] [--threads n]
+//   portals --pvs-merge map.bin part... [--pvs-cache directory]
+//   portals --pvs-workers n map.bin [--pvs-cache directory]
+//
+// A part file is a visibility file of the rows of the range, keyed by the map and the first
+// room of the range, so parts of other maps or given out of order are refused.
+class PvsPartition
+{
+public:
+    static int run(const std::string& executable, std::vector<std::string> args);
+
+    // Writes the rows of the rooms firstRoomId up to endRoomId of the map to the part file
+    static int computeRange(const std::string& mapPath, unsigned firstRoomId, unsigned endRoomId, const std::string& partPath);
+    // Joins the part files, given in the order of their ranges, into the cache of the map
+    static int merge(const std::string& mapPath, const std::vector<std::string>& partPaths, const std::string& cacheDirectory);
+    // Runs the executable as workers on equal ranges of the rooms at once, then merges their parts
+    static int runWorkers(const std::string& executable, const std::string& mapPath, unsigned nWorkers, const std::string& cacheDirectory);
+
+    static std::string getPartPath(const std::string& mapPath, unsigned firstRoomId, unsigned endRoomId);
+
+private:
+    static bool parseCount(const std::string& text, unsigned& value);
+    static uint64_t getPartKey(MapGen& map, unsigned firstRoomId);
+};
@@ -0,0 +1,410 @@
+#include "room_graph.hpp"
+
+#include <algorithm>
+#include <bit>
+#include <omp.h>
+
+static bool isDoorBefore(const RoomGraph::Door& first, const RoomGraph::Door& second)
+{
+    return first.tileId < second.tileId || (first.tileId == second.tileId && first.doorType < second.doorType);
+}
+
+static void prefixSum(vector<unsigned>& counts)
+{
+    for (unsigned i = 1; i < counts.size(); i++)
+        counts[i] += counts[i - 1];
+}
+
+RoomGraph RoomGraph::build(MapGen& map)
+{
+    RoomGraph graph;
+    graph.width = map.width;
+
+    unsigned nRooms = map.getRoomCount();
+    unsigned width = map.width;
+    int height = map.height;
+
+    // count the tiles and doors of every room
+    graph.tileBegins.assign(nRooms + 1, 0u);
+    graph.doorBegins.assign(nRooms + 1, 0u);
+
+    #pragma omp parallel for schedule(static)
+    for (int y = 0; y < height; y++)
+    {
+        for (unsigned i = y * width; i < (y + 1) * width; i++)
+        {
+            MapGen::Tile tile = map.getTileDirect(i);
+            if (!map.isTileInRoom(tile))
+                continue;
+
+            unsigned nDoors = std::popcount(tile.status & 0xF0u);
+
+            #pragma omp atomic
+            graph.tileBegins[tile.roomId + 1]++;
+
+            #pragma omp atomic
+            graph.doorBegins[tile.roomId + 1] += nDoors;
+        }
+    }
+
+    prefixSum(graph.tileBegins);
+    prefixSum(graph.doorBegins);
+
+    // fill the rooms, entries of a room come in any order and are sorted below
+    graph.tiles.resize(graph.tileBegins.back());
+    graph.doors.resize(graph.doorBegins.back());
+
+    vector<unsigned> tileEnds(graph.tileBegins.begin(), graph.tileBegins.end() - 1);
+    vector<unsigned> doorEnds(graph.doorBegins.begin(), graph.doorBegins.end() - 1);
+
+    #pragma omp parallel for schedule(static)
+    for (int y = 0; y < height; y++)
+    {
+        for (unsigned x = 0; x < width; x++)
+        {
+            MapGen::Tile tile = map.getTile(x, y);
+            if (!map.isTileInRoom(tile))
+                continue;
+
+            unsigned tileEntry;
+            #pragma omp atomic capture
+            tileEntry = tileEnds[tile.roomId]++;
+
+            graph.tiles[tileEntry] = y * width + x;
+
+            for (unsigned direction = 0; direction < 4; direction++)
+            {
+                if (!map.hasTileAttrib(tile, (TileAttrib)((unsigned)TileAttrib::DoorUp << direction)))
+                    continue;
+
+                unsigned doorEntry;
+                #pragma omp atomic capture
+                doorEntry = doorEnds[tile.roomId]++;
+
+                graph.doors[doorEntry] = makeDoor(map, x, y, direction);
+            }
+        }
+    }
+
+    // sort the rooms and trace their walls, each thread traces a contiguous range of rooms
+    // so that joining the thread buffers in order keeps the rooms in order
+    vector<vector<glm::vec2>> threadCorners(omp_get_max_threads());
+    graph.cornerBegins.assign(nRooms + 1, 0u);
+
+    #pragma omp parallel num_threads(threadCorners.size())
+    {
+        unsigned thread = omp_get_thread_num();
+        unsigned nThreads = omp_get_num_threads();
+        unsigned roomBegin = (unsigned)((unsigned long long)nRooms * thread / nThreads);
+        unsigned roomEnd = (unsigned)((unsigned long long)nRooms * (thread + 1) / nThreads);
+
+        for (unsigned roomId = roomBegin; roomId < roomEnd; roomId++)
+        {
+            std::sort(graph.tiles.begin() + graph.tileBegins[roomId], graph.tiles.begin() + graph.tileBegins[roomId + 1]);
+            std::sort(graph.doors.begin() + graph.doorBegins[roomId], graph.doors.begin() + graph.doorBegins[roomId + 1], isDoorBefore);
+
+            if (graph.tileBegins[roomId] == graph.tileBegins[roomId + 1])
+                continue;
+
+            size_t nCorners = threadCorners[thread].size();
+            traceCorners(map, graph.tiles[graph.tileBegins[roomId]], threadCorners[thread]);
+            graph.cornerBegins[roomId + 1] = threadCorners[thread].size() - nCorners;
+        }
+    }
+
+    prefixSum(graph.cornerBegins);
+    graph.corners.reserve(graph.cornerBegins.back());
+    for (auto& corners : threadCorners)
+        graph.corners.insert(graph.corners.end(), corners.begin(), corners.end());
+
+    // link both sides of every door
+    #pragma omp parallel for schedule(static)
+    for (int doorId = 0; doorId < (int)graph.doors.size(); doorId++)
+        graph.linkDoor(graph.doors[doorId], width);
+
+    graph.fillDoorArrays(0);
+
+    graph.walls.resize(graph.corners.size());
+    graph.horizontalWallBegins.resize(nRooms);
+
+    #pragma omp parallel for schedule(static)
+    for (int roomId = 0; roomId < (int)nRooms; roomId++)
+        graph.fillWalls(roomId);
+
+    return graph;
+}
+
+void RoomGraph::updateDoors(MapGen& map, vector<unsigned> roomIds)
+{
+    std::sort(roomIds.begin(), roomIds.end());
+    roomIds.erase(std::unique(roomIds.begin(), roomIds.end()), roomIds.end());
+    if (roomIds.empty())
+        return;
+
+    unsigned nRooms = getRoomCount();
+    auto isUpdated = [&](unsigned roomId) { return std::binary_search(roomIds.begin(), roomIds.end(), roomId); };
+
+    // tiles are in row order, so the doors come sorted as in build
+    vector<vector<Door>> roomDoors(roomIds.size());
+    for (unsigned i = 0; i < roomIds.size(); i++)
+    {
+        for (unsigned tileId : getTiles(roomIds[i]))
+        {
+            MapGen::Tile tile = map.getTileDirect(tileId);
+
+            for (unsigned direction = 0; direction < 4; direction++)
+            {
+                if (map.hasTileAttrib(tile, (TileAttrib)((unsigned)TileAttrib::DoorUp << direction)))
+                    roomDoors[i].push_back(makeDoor(map, tileId % map.width, tileId / map.width, direction));
+            }
+        }
+    }
+
+    // splice the rooms in place from the last one, so the earlier ranges stay where they are
+    vector<unsigned> oldDoorBegins = doorBegins;
+    for (int i = (int)roomIds.size() - 1; i >= 0; i--)
+    {
+        unsigned roomId = roomIds[i];
+        unsigned doorBegin = doorBegins[roomId];
+        unsigned doorEnd = doorBegins[roomId + 1];
+        int nAdded = (int)roomDoors[i].size() - (int)(doorEnd - doorBegin);
+
+        if (nAdded > 0)
+            doors.insert(doors.begin() + doorEnd, nAdded, Door());
+        else if (nAdded < 0)
+            doors.erase(doors.begin() + doorEnd + nAdded, doors.begin() + doorEnd);
+
+        std::copy(roomDoors[i].begin(), roomDoors[i].end(), doors.begin() + doorBegin);
+
+        for (unsigned laterRoomId = roomId + 1; laterRoomId <= nRooms; laterRoomId++)
+            doorBegins[laterRoomId] += nAdded;
+    }
+
+    // doors of unchanged rooms follow their moved twins, the rest are looked up again
+    #pragma omp parallel for schedule(static)
+    for (int doorId = 0; doorId < (int)doors.size(); doorId++)
+    {
+        Door& door = doors[doorId];
+
+        if (isUpdated(door.roomId) || isUpdated(door.otherRoomId))
+            linkDoor(door, map.width);
+        else
+            door.otherDoorId = door.otherDoorId - oldDoorBegins[door.otherRoomId] + doorBegins[door.otherRoomId];
+    }
+
+    // the doors before the first updated room did not move
+    fillDoorArrays(doorBegins[roomIds[0]]);
+
+    for (unsigned roomId : roomIds)
+        fillWalls(roomId);
+}
+
+void RoomGraph::fillDoorArrays(unsigned firstDoorId)
+{
+    for (auto array : { &doorX0, &doorY0, &doorX1, &doorY1 })
+        array->resize(doors.size());
+    doorIsVertical.resize(doors.size());
+
+    #pragma omp parallel for schedule(static)
+    for (int doorId = firstDoorId; doorId < (int)doors.size(); doorId++)
+    {
+        const Door& door = doors[doorId];
+
+        doorX0[doorId] = door.locations[0].x;
+        doorY0[doorId] = door.locations[0].y;
+        doorX1[doorId] = door.locations[1].x;
+        doorY1[doorId] = door.locations[1].y;
+        doorIsVertical[doorId] = door.locations[0].x == door.locations[1].x;
+    }
+}
+
+RoomGraph::Door RoomGraph::makeDoor(MapGen& map, unsigned x, unsigned y, unsigned direction)
+{
+    Door door;
+    door.locations[0] = glm::vec2(x, y) + doorOffsets[direction][0];
+    door.locations[1] = glm::vec2(x, y) + doorOffsets[direction][1];
+    door.roomId = map.getTile(x, y).roomId;
+    door.otherRoomId = map.getTile(x + otherTileOffsets[direction].x, y + otherTileOffsets[direction].y).roomId;
+    door.tileId = y * map.width + x;
+    door.doorType = (TileAttrib)((unsigned)TileAttrib::DoorUp << direction);
+
+    return door;
+}
+
+void RoomGraph::linkDoor(Door& door, unsigned width)
+{
+    unsigned direction = std::countr_zero((unsigned)door.doorType) - 4;
+
+    Door other;
+    other.tileId = door.tileId + otherTileOffsets[direction].y * width + otherTileOffsets[direction].x;
+    other.doorType = (TileAttrib)((unsigned)TileAttrib::DoorUp << ((direction + 2) % 4));
+
+    auto otherDoors = doors.begin() + doorBegins[door.otherRoomId];
+    auto otherDoorsEnd = doors.begin() + doorBegins[door.otherRoomId + 1];
+    door.otherDoorId = std::lower_bound(otherDoors, otherDoorsEnd, other, isDoorBefore) - doors.begin();
+
+    assert(door.otherDoorId < doors.size() && doors[door.otherDoorId].tileId == other.tileId);
+}
+
+// Follows the walls clockwise from the top left tile, which always has a wall above it
+void RoomGraph::traceCorners(MapGen& map, unsigned startTile, vector<glm::vec2>& corners)
+{
+    size_t firstCorner = corners.size();
+
+    // direction of the wall being followed, turning right is + 1
+    unsigned wall = 0;
+
+    int x = startTile % map.width;
+    int y = startTile / map.width;
+
+    while (true)
+    {
+        MapGen::Tile tile = map.getTile(x, y);
+
+        if (!map.hasTileAttrib(tile, (TileAttrib)(1u << wall)))
+        {
+            wall = (wall + 3) % 4;
+
+            glm::vec2 newCorner = glm::ivec2(x, y) + cornerOffsets[wall];
+            if (corners.size() > firstCorner && corners[firstCorner] == newCorner)
+                break;
+
+            corners.push_back(newCorner);
+
+            x += wallStepOffsets[wall].x;
+            y += wallStepOffsets[wall].y;
+
+            continue;
+        }
+
+        if (!map.hasTileAttrib(tile, (TileAttrib)(1u << ((wall + 1) % 4))))
+        {
+            x += wallStepOffsets[wall].x;
+            y += wallStepOffsets[wall].y;
+        }
+        else
+        {
+            glm::vec2 newCorner = glm::ivec2(x, y) + cornerOffsets[wall];
+            if (corners.size() > firstCorner && corners[firstCorner] == newCorner)
+                break;
+
+            corners.push_back(newCorner);
+
+            wall = (wall + 1) % 4;
+        }
+    }
+}
+
+unsigned RoomGraph::getRoomCount() const
+{
+    return tileBegins.size() - 1;
+}
+
+unsigned RoomGraph::getDoorCount() const
+{
+    return doors.size();
+}
+
+std::span<const unsigned> RoomGraph::getTiles(unsigned roomId) const
+{
+    assert(roomId < getRoomCount());
+
+    return std::span<const unsigned>(tiles.data() + tileBegins[roomId], tileBegins[roomId + 1] - tileBegins[roomId]);
+}
+
+glm::vec2 RoomGraph::getTileCorner(unsigned tileId) const
+{
+    return glm::vec2(tileId % width, tileId / width);
+}
+
+std::span<const glm::vec2> RoomGraph::getCorners(unsigned roomId) const
+{
+    assert(roomId < getRoomCount());
+
+    return std::span<const glm::vec2>(corners.data() + cornerBegins[roomId], cornerBegins[roomId + 1] - cornerBegins[roomId]);
+}
+
+std::span<const RoomGraph::Door> RoomGraph::getDoors(unsigned roomId) const
+{
+    assert(roomId < getRoomCount());
+
+    return std::span<const Door>(doors.data() + doorBegins[roomId], doorBegins[roomId + 1] - doorBegins[roomId]);
+}
+
+const RoomGraph::Door& RoomGraph::getDoor(unsigned doorId) const
+{
+    assert(doorId < doors.size());
+
+    return doors[doorId];
+}
+
+void RoomGraph::fillWalls(unsigned roomId)
+{
+    std::span<const glm::vec2> roomCorners = getCorners(roomId);
+    auto roomWalls = walls.begin() + cornerBegins[roomId];
+
+    unsigned nVertical = 0;
+    for (unsigned i = 0; i < roomCorners.size(); i++)
+        nVertical += roomCorners[i].x == roomCorners[(i + 1) % roomCorners.size()].x;
+
+    unsigned nextVertical = 0;
+    unsigned nextHorizontal = nVertical;
+
+    for (unsigned i = 0; i < roomCorners.size(); i++)
+    {
+        glm::vec2 start = roomCorners[i];
+        glm::vec2 end = roomCorners[(i + 1) % roomCorners.size()];
+        bool isVertical = start.x == end.x;
+
+        Wall wall;
+        wall.plane = isVertical ? start.x : start.y;
+        wall.min = isVertical ? min(start.y, end.y) : min(start.x, end.x);
+        wall.max = isVertical ? max(start.y, end.y) : max(start.x, end.x);
+        wall.hasDoor = false;
+
+        // doors lie strictly inside the wall they are in
+        for (const Door& door : getDoors(roomId))
+        {
+            bool isDoorVertical = door.locations[0].x == door.locations[1].x;
+            float doorPlane = isDoorVertical ? door.locations[0].x : door.locations[0].y;
+            float doorBegin = isDoorVertical ? door.locations[0].y : door.locations[0].x;
+            float doorEnd = isDoorVertical ? door.locations[1].y : door.locations[1].x;
+
+            wall.hasDoor |= isDoorVertical == isVertical && doorPlane == wall.plane
+                && doorBegin > wall.min && doorBegin < wall.max && doorEnd > wall.min && doorEnd < wall.max;
+        }
+
+        roomWalls[isVertical ? nextVertical++ : nextHorizontal++] = wall;
+    }
+
+    auto isWallBefore = [](const Wall& first, const Wall& second) { return first.plane < second.plane; };
+    std::sort(roomWalls, roomWalls + nVertical, isWallBefore);
+    std::sort(roomWalls + nVertical, roomWalls + roomCorners.size(), isWallBefore);
+
+    horizontalWallBegins[roomId] = cornerBegins[roomId] + nVertical;
+}
+
+std::span<const RoomGraph::Wall> RoomGraph::getWalls(unsigned roomId, bool isVertical) const
+{
+    assert(roomId < getRoomCount());
+
+    unsigned begin = isVertical ? cornerBegins[roomId] : horizontalWallBegins[roomId];
+    unsigned end = isVertical ? horizontalWallBegins[roomId] : cornerBegins[roomId + 1];
+
+    return std::span<const Wall>(walls.data() + begin, end - begin);
+}
+
+RoomGraph::DoorArrays RoomGraph::getDoorArrays(unsigned roomId) const
+{
+    assert(roomId < getRoomCount());
+
+    unsigned begin = doorBegins[roomId];
+    return { doorX0.data() + begin, doorY0.data() + begin, doorX1.data() + begin, doorY1.data() + begin, doorIsVertical.data() + begin, doorBegins[roomId + 1] - begin };
+}
+
+unsigned RoomGraph::getDoorId(const Door& door) const
+{
+    assert(&door >= doors.data() && &door < doors.data() + doors.size());
+
+    return &door - doors.data();
+}
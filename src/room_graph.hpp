@@ -0,0 +1,118 @@
+#pragma once
+
+#include <vector>
+#include <span>
+
+#include "glm/glm.hpp"
+
+#include "map_gen.hpp"
+
+// Rooms of a map with their tiles, wall corners and doors in compressed sparse row form.
+// Room r owns the entries [begins[r], begins[r + 1]) of each table. Built once from the
+// tile grid and shared by visibility and rendering. Door coordinates are kept as structures
+// of arrays as well, for tests over all doors of a room at once.
+class RoomGraph
+{
+public:
+    struct Door
+    {
+        glm::vec2 locations[2]{};
+        unsigned roomId;
+        unsigned otherRoomId;
+        // the same door in the other room's list
+        unsigned otherDoorId;
+        // tile of roomId the door is on
+        unsigned tileId;
+        TileAttrib doorType;
+    };
+
+    // endpoints and orientation of a room's doors, in the order of getDoors
+    struct DoorArrays
+    {
+        const float* x0;
+        const float* y0;
+        const float* x1;
+        const float* y1;
+        const uint8_t* isVertical;
+        unsigned size;
+    };
+
+    // wall between two corners, from min to max along the plane
+    struct Wall
+    {
+        float plane;
+        float min;
+        float max;
+        // walls with a door in them let everything through
+        bool hasDoor;
+    };
+
+    // part of the wall a door spans, from the wall start
+    inline static const float doorStartOffset = 0.35f;
+    inline static const float doorEndOffset = 0.65f;
+
+    static RoomGraph build(MapGen& map);
+    // Reads the doors of the rooms from the map again after doors were added or removed
+    // between them, door ids of the other rooms may move
+    void updateDoors(MapGen& map, vector<unsigned> roomIds);
+
+    unsigned getRoomCount() const;
+    unsigned getDoorCount() const;
+    // y * width + x of the room's tiles in row order
+    std::span<const unsigned> getTiles(unsigned roomId) const;
+    // corner of the tile with the lowest coordinates, the tile spans one unit from it
+    glm::vec2 getTileCorner(unsigned tileId) const;
+    // walls run between consecutive corners, the last one joins the first
+    std::span<const glm::vec2> getCorners(unsigned roomId) const;
+    std::span<const Door> getDoors(unsigned roomId) const;
+    const Door& getDoor(unsigned doorId) const;
+    unsigned getDoorId(const Door& door) const;
+    DoorArrays getDoorArrays(unsigned roomId) const;
+    // walls of the room in one orientation, sorted by their plane
+    std::span<const Wall> getWalls(unsigned roomId, bool isVertical) const;
+
+private:
+    unsigned width = 0;
+
+    vector<unsigned> tileBegins = { 0 };
+    vector<unsigned> tiles;
+
+    vector<unsigned> cornerBegins = { 0 };
+    vector<glm::vec2> corners;
+
+    vector<unsigned> doorBegins = { 0 };
+    vector<Door> doors;
+
+    // doors as structure of arrays
+    vector<float> doorX0;
+    vector<float> doorY0;
+    vector<float> doorX1;
+    vector<float> doorY1;
+    vector<uint8_t> doorIsVertical;
+
+    // a wall per corner, the vertical walls of a room come before the horizontal ones
+    vector<Wall> walls;
+    vector<unsigned> horizontalWallBegins;
+
+    // indexed by direction, up, right, down, left as in TileAttrib
+    inline static const glm::ivec2 cornerOffsets[4] = { {1, 0}, {1, 1}, {0, 1}, {0, 0} };
+    inline static const glm::ivec2 wallStepOffsets[4] = { {1, 0}, {0, 1}, {-1, 0}, {0, -1} };
+    inline static const glm::ivec2 otherTileOffsets[4] = { {0, -1}, {1, 0}, {0, 1}, {-1, 0} };
+
+    inline static const glm::vec2 doorOffsets[4][2] =
+    {
+        {{doorStartOffset, 0.f}, {doorEndOffset, 0.f}},
+        {{1.f, doorStartOffset}, {1.f, doorEndOffset}},
+        {{doorStartOffset, 1.f}, {doorEndOffset, 1.f}},
+        {{0.f, doorStartOffset}, {0.f, doorEndOffset}}
+    };
+
+    static void traceCorners(MapGen& map, unsigned startTile, vector<glm::vec2>& corners);
+    static Door makeDoor(MapGen& map, unsigned x, unsigned y, unsigned direction);
+    // Finds the twin of the door in the other room
+    void linkDoor(Door& door, unsigned width);
+    // Copies the doors from firstDoorId on into the door arrays
+    void fillDoorArrays(unsigned firstDoorId);
+    // Splits the walls of the room by orientation and marks the ones with doors
+    void fillWalls(unsigned roomId);
+};
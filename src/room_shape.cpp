@@ -1,15 +1,15 @@
 #include "map_gen.hpp"
 
-const RoomShape RoomShapeFactory::I = { {0, 0}, {0, 1}, {0, 2}, {0, 3} };
-const RoomShape RoomShapeFactory::L = { {0, 0}, {0, 1}, {0, 2}, {1, 2} };
-const RoomShape RoomShapeFactory::O = { {0, 0}, {1, 0}, {0, 1}, {1, 1} };
-const RoomShape RoomShapeFactory::z = { {0, 0}, {1, 0}, {1, 1}, {2, 1} };
-const RoomShape RoomShapeFactory::Z = { {0, 0}, {1, 0}, {1, 1}, {1, 2}, {2, 2} };
-const RoomShape RoomShapeFactory::T = { {0, 0}, {1, 0}, {2, 0}, {1, 1} };
-const RoomShape RoomShapeFactory::U = { {0, 0}, {0, 1}, {0, 2}, {1, 2}, {2, 2}, {2, 1 }, {2, 0} };
-const RoomShape RoomShapeFactory::X = { {0, 0}, {-1, 1},{0, 1}, {1, 1}, {0, 2} };
-const RoomShape RoomShapeFactory::W = { {0, 0}, {0, 1}, {1, 1}, {1, 2}, {2, 2} };
-const RoomShape RoomShapeFactory::H = { {0, 0}, {1, 0}, {2, 0}, {1, 1}, {0, 2}, {1, 2}, {2, 2} };
+const RoomShape RoomShapeFactory::I = defs[0];
+const RoomShape RoomShapeFactory::L = defs[1];
+const RoomShape RoomShapeFactory::O = defs[2];
+const RoomShape RoomShapeFactory::z = defs[3];
+const RoomShape RoomShapeFactory::Z = defs[4];
+const RoomShape RoomShapeFactory::T = defs[5];
+const RoomShape RoomShapeFactory::U = defs[6];
+const RoomShape RoomShapeFactory::X = defs[7];
+const RoomShape RoomShapeFactory::W = defs[8];
+const RoomShape RoomShapeFactory::H = defs[9];
 
 RoomShape::RoomShape()
 {
@@ -26,6 +26,21 @@ RoomShape::RoomShape(initializer_list<Point> segments)
     this->segments = segments;
 }
 
+RoomShape::RoomShape(const ShapeDef& def)
+{
+    for (unsigned i = 0; i < def.nSegments; i++)
+        segments.push_back(Point(def.segments[i][0], def.segments[i][1]));
+}
+
+RoomShape::RoomShape(const ShapeConfig& config, unsigned x, unsigned y)
+{
+    this->config = config.configId;
+
+    segments.resize(config.nSegments);
+    for (unsigned i = 0; i < config.nSegments; i++)
+        segments[i] = Point(x + config.segments[i][0], y + config.segments[i][1]);
+}
+
 RoomShape RoomShape::deepCopy() const
 {
     RoomShape newRoom = RoomShape();
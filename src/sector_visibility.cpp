@@ -0,0 +1,195 @@
+#include "sector_visibility.hpp"
+
+#include <algorithm>
+
+SectorVisibility::SectorVisibility(const RoomGraph* graph, MapGen& map, unsigned sectorSide) : portal(graph)
+{
+    this->graph = graph;
+    this->sectorSide = sectorSide;
+    mapWidth = map.width;
+    sectorsPerRow = (map.width + sectorSide - 1) / sectorSide;
+
+    unsigned nSectors = sectorsPerRow * ((map.height + sectorSide - 1) / sectorSide);
+    sectors.resize(nSectors);
+
+    // rooms are counted into their sectors and placed in ascending order
+    sectorRoomBegins.assign(nSectors + 1, 0);
+    for (unsigned roomId = 0; roomId < graph->getRoomCount(); roomId++)
+        sectorRoomBegins[getSectorId(roomId) + 1]++;
+
+    for (unsigned sectorId = 0; sectorId < nSectors; sectorId++)
+        sectorRoomBegins[sectorId + 1] += sectorRoomBegins[sectorId];
+
+    std::vector<unsigned> nextRooms(sectorRoomBegins.begin(), sectorRoomBegins.end() - 1);
+    sectorRoomIds.resize(graph->getRoomCount());
+    for (unsigned roomId = 0; roomId < graph->getRoomCount(); roomId++)
+        sectorRoomIds[nextRooms[getSectorId(roomId)]++] = roomId;
+}
+
+unsigned SectorVisibility::getSectorCount() const
+{
+    return sectors.size();
+}
+
+unsigned SectorVisibility::getSectorId(unsigned roomId) const
+{
+    unsigned tileId = graph->getTiles(roomId)[0];
+    return (tileId / mapWidth / sectorSide) * sectorsPerRow + tileId % mapWidth / sectorSide;
+}
+
+std::span<const unsigned> SectorVisibility::getSectorRooms(unsigned sectorId) const
+{
+    return std::span<const unsigned>(sectorRoomIds.data() + sectorRoomBegins[sectorId], sectorRoomBegins[sectorId + 1] - sectorRoomBegins[sectorId]);
+}
+
+unsigned SectorVisibility::getRoomIndex(unsigned roomId, unsigned sectorId) const
+{
+    std::span<const unsigned> rooms = getSectorRooms(sectorId);
+    return std::lower_bound(rooms.begin(), rooms.end(), roomId) - rooms.begin();
+}
+
+std::span<const unsigned> SectorVisibility::getVisibleSectors(unsigned sectorId)
+{
+    return getSearchedSector(sectorId).visibleSectorIds;
+}
+
+bool SectorVisibility::isVisible(unsigned fromRoomId, unsigned toRoomId)
+{
+    unsigned fromSectorId = getSectorId(fromRoomId);
+    unsigned toSectorId = getSectorId(toRoomId);
+    const Sector& sector = getSearchedSector(fromSectorId);
+
+    // most rooms are told apart by their sectors alone
+    auto visibleSector = std::lower_bound(sector.visibleSectorIds.begin(), sector.visibleSectorIds.end(), toSectorId);
+    if (visibleSector == sector.visibleSectorIds.end() || *visibleSector != toSectorId)
+        return false;
+
+    unsigned rowIndex = getRoomIndex(fromRoomId, fromSectorId);
+    uint32_t entry = sector.candidateBegins[visibleSector - sector.visibleSectorIds.begin()] + getRoomIndex(toRoomId, toSectorId);
+
+    return std::binary_search(sector.entries.begin() + sector.rowBegins[rowIndex], sector.entries.begin() + sector.rowBegins[rowIndex + 1], entry);
+}
+
+void SectorVisibility::getRow(unsigned roomId, std::vector<unsigned>& row)
+{
+    unsigned sectorId = getSectorId(roomId);
+    const Sector& sector = getSearchedSector(sectorId);
+    unsigned rowIndex = getRoomIndex(roomId, sectorId);
+
+    row.clear();
+    for (unsigned i = sector.rowBegins[rowIndex]; i < sector.rowBegins[rowIndex + 1]; i++)
+    {
+        unsigned entry = sector.entries[i];
+        unsigned visibleIndex = std::upper_bound(sector.candidateBegins.begin(), sector.candidateBegins.end(), entry) - sector.candidateBegins.begin() - 1;
+
+        row.push_back(getSectorRooms(sector.visibleSectorIds[visibleIndex])[entry - sector.candidateBegins[visibleIndex]]);
+    }
+
+    // candidates are ordered by sector first
+    std::sort(row.begin(), row.end());
+}
+
+// A door is only read by searches that enter one of its rooms, so only sectors seeing the
+// sector of either room can change
+unsigned SectorVisibility::invalidate(unsigned roomId, unsigned otherRoomId)
+{
+    unsigned changedSectorIds[2] = { getSectorId(roomId), getSectorId(otherRoomId) };
+    size_t nSearched = searchedSectorIds.size();
+
+    std::erase_if(searchedSectorIds, [&](unsigned sectorId)
+    {
+        const std::vector<unsigned>& visibleSectorIds = sectors[sectorId].visibleSectorIds;
+        bool isStale = std::binary_search(visibleSectorIds.begin(), visibleSectorIds.end(), changedSectorIds[0])
+            || std::binary_search(visibleSectorIds.begin(), visibleSectorIds.end(), changedSectorIds[1]);
+
+        if (isStale)
+            sectors[sectorId] = Sector();
+
+        return isStale;
+    });
+
+    return nSearched - searchedSectorIds.size();
+}
+
+void SectorVisibility::evict(unsigned sectorId, unsigned radius)
+{
+    glm::ivec2 center(sectorId % sectorsPerRow, sectorId / sectorsPerRow);
+
+    std::erase_if(searchedSectorIds, [&](unsigned searchedId)
+    {
+        glm::ivec2 offset = glm::abs(glm::ivec2(searchedId % sectorsPerRow, searchedId / sectorsPerRow) - center);
+        bool isFar = (unsigned)max(offset.x, offset.y) > radius;
+
+        if (isFar)
+            sectors[searchedId] = Sector();
+
+        return isFar;
+    });
+}
+
+unsigned SectorVisibility::getSearchedSectorCount() const
+{
+    return searchedSectorIds.size();
+}
+
+size_t SectorVisibility::getBytes() const
+{
+    size_t bytes = sectors.size() * sizeof(Sector) + sectorRoomBegins.size() * sizeof(unsigned)
+        + sectorRoomIds.size() * sizeof(unsigned) + searchedSectorIds.size() * sizeof(unsigned);
+
+    for (unsigned sectorId : searchedSectorIds)
+    {
+        const Sector& sector = sectors[sectorId];
+        bytes += (sector.visibleSectorIds.size() + sector.candidateBegins.size() + sector.rowBegins.size()) * sizeof(unsigned)
+            + sector.entries.size() * sizeof(uint32_t);
+    }
+
+    return bytes;
+}
+
+const SectorVisibility::Sector& SectorVisibility::getSearchedSector(unsigned sectorId)
+{
+    if (!sectors[sectorId].isSearched)
+        search(sectorId);
+
+    return sectors[sectorId];
+}
+
+void SectorVisibility::search(unsigned sectorId)
+{
+    std::span<const unsigned> rooms = getSectorRooms(sectorId);
+    std::vector<std::vector<unsigned>> rows = portal.getRows(std::vector<unsigned>(rooms.begin(), rooms.end()), searchThreads);
+
+    Sector& sector = sectors[sectorId];
+
+    for (const auto& row : rows)
+    {
+        for (unsigned visibleId : row)
+            sector.visibleSectorIds.push_back(getSectorId(visibleId));
+    }
+
+    std::sort(sector.visibleSectorIds.begin(), sector.visibleSectorIds.end());
+    sector.visibleSectorIds.erase(std::unique(sector.visibleSectorIds.begin(), sector.visibleSectorIds.end()), sector.visibleSectorIds.end());
+
+    sector.candidateBegins = { 0 };
+    for (unsigned visibleSectorId : sector.visibleSectorIds)
+        sector.candidateBegins.push_back(sector.candidateBegins.back() + sectorRoomBegins[visibleSectorId + 1] - sectorRoomBegins[visibleSectorId]);
+
+    sector.rowBegins = { 0 };
+    for (const auto& row : rows)
+    {
+        for (unsigned visibleId : row)
+        {
+            unsigned visibleSectorId = getSectorId(visibleId);
+            unsigned visibleIndex = std::lower_bound(sector.visibleSectorIds.begin(), sector.visibleSectorIds.end(), visibleSectorId) - sector.visibleSectorIds.begin();
+
+            sector.entries.push_back(sector.candidateBegins[visibleIndex] + getRoomIndex(visibleId, visibleSectorId));
+        }
+
+        std::sort(sector.entries.begin() + sector.rowBegins.back(), sector.entries.end());
+        sector.rowBegins.push_back(sector.entries.size());
+    }
+
+    sector.isSearched = true;
+    searchedSectorIds.push_back(sectorId);
+}
@@ -0,0 +1,78 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <span>
+#include <vector>
+
+#include "map_gen.hpp"
+#include "portal_visibility.hpp"
+#include "room_graph.hpp"
+
+// Visibilities of a map split into square sectors of tiles, each searched only when a room of
+// it is first looked up. A room belongs to the sector of its first tile.
+//
+// A searched sector keeps the sectors any of its rooms sees, and the rows of its rooms as
+// indices into the candidates, the rooms of those sectors one after another. Lookups first
+// find the sector of the other room among the visible ones and then the room in the row, so
+// their cost and the memory held both follow the neighbourhood of the searched sectors.
+class SectorVisibility
+{
+public:
+    SectorVisibility(const RoomGraph* graph, MapGen& map, unsigned sectorSide);
+    SectorVisibility(const SectorVisibility&) = delete;
+    SectorVisibility& operator=(const SectorVisibility&) = delete;
+
+    unsigned getSectorCount() const;
+    unsigned getSectorId(unsigned roomId) const;
+    // rooms of the sector in ascending order
+    std::span<const unsigned> getSectorRooms(unsigned sectorId) const;
+
+    // Sectors seen from any room of the sector in ascending order, searching it if needed
+    std::span<const unsigned> getVisibleSectors(unsigned sectorId);
+    bool isVisible(unsigned fromRoomId, unsigned toRoomId);
+    // Replaces the contents of row with the rooms visible from roomId in ascending order
+    void getRow(unsigned roomId, std::vector<unsigned>& row);
+
+    // Drops the searched sectors seeing the sector of either room, after a door between them was
+    // added or removed and the graph was updated. Returns the number of dropped sectors.
+    unsigned invalidate(unsigned roomId, unsigned otherRoomId);
+    // Drops the searched sectors more than radius sectors away from the sector on either axis
+    void evict(unsigned sectorId, unsigned radius);
+
+    unsigned getSearchedSectorCount() const;
+    size_t getBytes() const;
+
+    // searches of the sectors, its counters cover the last search
+    PortalVisibility portal;
+
+private:
+    struct Sector
+    {
+        bool isSearched = false;
+        std::vector<unsigned> visibleSectorIds;
+        // first candidate of every visible sector
+        std::vector<unsigned> candidateBegins;
+        // row of room i of the sector is entries[rowBegins[i], rowBegins[i + 1]) in ascending order
+        std::vector<unsigned> rowBegins;
+        std::vector<uint32_t> entries;
+    };
+
+    const RoomGraph* graph;
+    unsigned sectorSide;
+    unsigned sectorsPerRow;
+    unsigned mapWidth;
+
+    std::vector<unsigned> sectorRoomBegins = { 0 };
+    std::vector<unsigned> sectorRoomIds;
+
+    std::vector<Sector> sectors;
+    std::vector<unsigned> searchedSectorIds;
+    // sets of the threads searching the sectors, kept between searches
+    std::vector<std::unique_ptr<PortalVisibility::SearchThread>> searchThreads;
+
+    const Sector& getSearchedSector(unsigned sectorId);
+    void search(unsigned sectorId);
+    // index of the room among the rooms of its sector
+    unsigned getRoomIndex(unsigned roomId, unsigned sectorId) const;
+};
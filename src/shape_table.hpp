@@ -0,0 +1,212 @@
+#pragma once
+
+#include <array>
+
+#include "map_gen.hpp"
+
+// Every default shape in every config, built at compile time with the same steps
+// as RoomShapeFactory::getDefaultShapes followed by RoomShape::getConfig
+
+using ShapeTable = std::array<std::array<ShapeConfig, N_CONFIGS>, N_SHAPES>;
+
+// Rows and columns of the occupancy window around an anchor, every config fits inside it
+#define FEASIBLE_WINDOW 7
+#define FEASIBLE_WINDOW_CENTER 3
+
+// For each window row and each occupancy pattern of that row (bit i is column
+// anchor - FEASIBLE_WINDOW_CENTER + i) the configs of every shape that leave the row's
+// occupied tiles free, bit c of entry s is config c of shape s. The configs fitting a whole
+// window are the AND over its rows.
+using FeasibleTable = std::array<std::array<std::array<uint8_t, N_SHAPES>, 1u << FEASIBLE_WINDOW>, FEASIBLE_WINDOW>;
+
+namespace shape_table
+{
+    constexpr bool isBefore(const int8_t* a, const int8_t* b)
+    {
+        return (a[1] < b[1]) || (a[1] == b[1] && a[0] < b[0]);
+    }
+
+    // RoomShape::recalculateOrigin
+    constexpr ShapeConfig getOrigin(const ShapeDef& def)
+    {
+        ShapeConfig shape;
+        shape.nSegments = def.nSegments;
+
+        int originX = def.segments[0][0];
+        int originY = def.segments[0][1];
+        for (unsigned i = 0; i < def.nSegments; i++)
+        {
+            shape.segments[i][0] = def.segments[i][0];
+            shape.segments[i][1] = def.segments[i][1];
+
+            if ((def.segments[i][1] < originY) || (def.segments[i][1] == originY && def.segments[i][0] < originX))
+            {
+                originX = def.segments[i][0];
+                originY = def.segments[i][1];
+            }
+        }
+
+        originX = originX < 0 ? -originX : originX;
+        originY = originY < 0 ? -originY : originY;
+
+        for (unsigned i = 0; i < shape.nSegments; i++)
+        {
+            shape.segments[i][0] += originX;
+            shape.segments[i][1] += originY;
+        }
+
+        // insertion sort, segments are unique so the order is fully determined
+        for (unsigned i = 1; i < shape.nSegments; i++)
+        {
+            for (unsigned j = i; j > 0 && isBefore(shape.segments[j], shape.segments[j - 1]); j--)
+            {
+                int8_t x = shape.segments[j][0];
+                int8_t y = shape.segments[j][1];
+                shape.segments[j][0] = shape.segments[j - 1][0];
+                shape.segments[j][1] = shape.segments[j - 1][1];
+                shape.segments[j - 1][0] = x;
+                shape.segments[j - 1][1] = y;
+            }
+        }
+
+        return shape;
+    }
+
+    // RoomShape::getConfig
+    constexpr ShapeConfig getConfig(ShapeConfig shape, unsigned configId)
+    {
+        for (unsigned config = 1; config <= configId; config++)
+        {
+            for (unsigned i = 0; i < shape.nSegments; i++)
+            {
+                int8_t x = shape.segments[i][0];
+                shape.segments[i][0] = -shape.segments[i][1];
+                shape.segments[i][1] = x;
+
+                if (config == 4)
+                    shape.segments[i][0] = -shape.segments[i][0];
+            }
+        }
+
+        shape.configId = configId;
+        return shape;
+    }
+
+    constexpr ShapeMask getMask(const ShapeConfig& shape)
+    {
+        ShapeMask mask;
+        mask.minX = mask.maxX = shape.segments[0][0];
+        mask.minY = mask.maxY = shape.segments[0][1];
+
+        for (unsigned i = 0; i < shape.nSegments; i++)
+        {
+            mask.minX = std::min(mask.minX, (int)shape.segments[i][0]);
+            mask.maxX = std::max(mask.maxX, (int)shape.segments[i][0]);
+            mask.minY = std::min(mask.minY, (int)shape.segments[i][1]);
+            mask.maxY = std::max(mask.maxY, (int)shape.segments[i][1]);
+        }
+
+        for (unsigned i = 0; i < shape.nSegments; i++)
+            mask.rows[shape.segments[i][1] - mask.minY] |= 1u << (shape.segments[i][0] - mask.minX);
+
+        return mask;
+    }
+
+    constexpr bool isSameMask(const ShapeMask& a, const ShapeMask& b)
+    {
+        if (a.minX != b.minX || a.maxX != b.maxX || a.minY != b.minY || a.maxY != b.maxY)
+            return false;
+
+        for (unsigned row = 0; row < std::size(a.rows); row++)
+        {
+            if (a.rows[row] != b.rows[row])
+                return false;
+        }
+
+        return true;
+    }
+
+    constexpr ShapeTable build()
+    {
+        ShapeTable table;
+
+        for (unsigned shapeId = 0; shapeId < N_SHAPES; shapeId++)
+        {
+            ShapeConfig origin = getOrigin(RoomShapeFactory::defs[shapeId]);
+
+            for (unsigned configId = 0; configId < N_CONFIGS; configId++)
+            {
+                ShapeConfig& config = table[shapeId][configId];
+                config = getConfig(origin, configId);
+                config.mask = getMask(config);
+
+                // same mask means the same tiles relative to the anchor
+                config.uniqueId = configId;
+                for (unsigned other = 0; other < configId; other++)
+                {
+                    if (isSameMask(config.mask, table[shapeId][other].mask))
+                    {
+                        config.uniqueId = other;
+                        break;
+                    }
+                }
+            }
+        }
+
+        return table;
+    }
+}
+
+inline constexpr ShapeTable shapeTable = shape_table::build();
+
+namespace shape_table
+{
+    constexpr FeasibleTable buildFeasible()
+    {
+        FeasibleTable table{};
+
+        for (unsigned row = 0; row < FEASIBLE_WINDOW; row++)
+        {
+            int y = (int)row - FEASIBLE_WINDOW_CENTER;
+
+            for (unsigned shapeId = 0; shapeId < N_SHAPES; shapeId++)
+            {
+                for (unsigned configId = 0; configId < N_CONFIGS; configId++)
+                {
+                    const ShapeMask& mask = shapeTable[shapeId][configId].mask;
+
+                    // tiles of the config in this row as a window row pattern
+                    unsigned rowBits = 0;
+                    if (y >= mask.minY && y <= mask.maxY)
+                        rowBits = (unsigned)mask.rows[y - mask.minY] << (mask.minX + FEASIBLE_WINDOW_CENTER);
+
+                    for (unsigned pattern = 0; pattern < (1u << FEASIBLE_WINDOW); pattern++)
+                    {
+                        if ((pattern & rowBits) == 0)
+                            table[row][pattern][shapeId] |= 1u << configId;
+                    }
+                }
+            }
+        }
+
+        return table;
+    }
+}
+
+inline constexpr FeasibleTable feasibleTable = shape_table::buildFeasible();
+
+static_assert(shapeTable[2][4].uniqueId == 1, "mirrored O is the same as O rotated once");
+
+static_assert([]
+{
+    for (auto& shape : shapeTable)
+    {
+        for (auto& config : shape)
+        {
+            if (config.mask.minX < -FEASIBLE_WINDOW_CENTER || config.mask.maxX > FEASIBLE_WINDOW_CENTER
+                || config.mask.minY < -FEASIBLE_WINDOW_CENTER || config.mask.maxY > FEASIBLE_WINDOW_CENTER)
+                return false;
+        }
+    }
+    return true;
+}(), "every config fits into the feasibility window");
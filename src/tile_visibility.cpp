@@ -0,0 +1,91 @@
+#include "tile_visibility.hpp"
+
+#include <algorithm>
+#include <assert.h>
+#include <bit>
+
+TileVisibility TileVisibility::fromRooms(const std::vector<RoomMasks>& rooms)
+{
+    TileVisibility visibility;
+    unsigned nRooms = rooms.size();
+
+    visibility.maskBegins.resize(nRooms + 1);
+    visibility.tileBegins.resize(nRooms + 1);
+    for (unsigned i = 0; i < nRooms; i++)
+    {
+        visibility.maskBegins[i + 1] = visibility.maskBegins[i] + rooms[i].words.size();
+        visibility.tileBegins[i + 1] = visibility.tileBegins[i] + rooms[i].tileMaskIds.size();
+    }
+
+    visibility.words.resize(visibility.maskBegins.back());
+    visibility.tileMaskIds.resize(visibility.tileBegins.back());
+
+    #pragma omp parallel for schedule(static)
+    for (int i = 0; i < (int)nRooms; i++)
+    {
+        std::copy(rooms[i].words.begin(), rooms[i].words.end(), visibility.words.begin() + visibility.maskBegins[i]);
+        std::copy(rooms[i].tileMaskIds.begin(), rooms[i].tileMaskIds.end(), visibility.tileMaskIds.begin() + visibility.tileBegins[i]);
+    }
+
+    return visibility;
+}
+
+void TileVisibility::setRooms(const std::vector<unsigned>& roomIds, const std::vector<RoomMasks>& rooms)
+{
+    unsigned nRooms = getRoomCount();
+
+    std::vector<uint64_t> newBegins(nRooms + 1, 0);
+    for (unsigned room = 0, i = 0; room < nRooms; room++)
+    {
+        bool isSet = i < roomIds.size() && roomIds[i] == room;
+        newBegins[room + 1] = newBegins[room] + (isSet ? rooms[i++].words.size() : maskBegins[room + 1] - maskBegins[room]);
+    }
+
+    std::vector<uint64_t> newWords(newBegins.back());
+    unsigned keptBegin = 0;
+    for (unsigned i = 0; i <= roomIds.size(); i++)
+    {
+        unsigned keptEnd = i < roomIds.size() ? roomIds[i] : nRooms;
+        std::copy(words.begin() + maskBegins[keptBegin], words.begin() + maskBegins[keptEnd], newWords.begin() + newBegins[keptBegin]);
+
+        if (i < roomIds.size())
+        {
+            unsigned roomId = roomIds[i];
+            assert(rooms[i].tileMaskIds.size() == tileBegins[roomId + 1] - tileBegins[roomId]);
+
+            std::copy(rooms[i].words.begin(), rooms[i].words.end(), newWords.begin() + newBegins[roomId]);
+            std::copy(rooms[i].tileMaskIds.begin(), rooms[i].tileMaskIds.end(), tileMaskIds.begin() + tileBegins[roomId]);
+        }
+
+        keptBegin = keptEnd + 1;
+    }
+
+    maskBegins = std::move(newBegins);
+    words = std::move(newWords);
+}
+
+unsigned TileVisibility::getRoomCount() const
+{
+    return maskBegins.size() - 1;
+}
+
+size_t TileVisibility::getBytes() const
+{
+    return maskBegins.size() * sizeof(uint64_t) + words.size() * sizeof(uint64_t)
+        + tileBegins.size() * sizeof(unsigned) + tileMaskIds.size();
+}
+
+void TileVisibility::getRow(unsigned roomId, unsigned tileIndex, const std::vector<unsigned>& roomRow, std::vector<unsigned>& row) const
+{
+    assert(roomId < getRoomCount() && tileBegins[roomId] + tileIndex < tileBegins[roomId + 1]);
+
+    unsigned maskWords = (roomRow.size() + 63) / 64;
+    const uint64_t* mask = words.data() + maskBegins[roomId] + tileMaskIds[tileBegins[roomId] + tileIndex] * maskWords;
+
+    row.clear();
+    for (unsigned word = 0; word < maskWords; word++)
+    {
+        for (uint64_t wordBits = mask[word]; wordBits != 0; wordBits &= wordBits - 1)
+            row.push_back(roomRow[word * 64 + std::countr_zero(wordBits)]);
+    }
+}
@@ -0,0 +1,47 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+// Rooms visible from every tile of a room, as subsets of the row of the room in the room
+// visibilities. A subset is a mask with one bit per entry of the row and tiles with the same
+// subset share one mask.
+//
+// Room r keeps its masks one after another in words[maskBegins[r], maskBegins[r + 1]), each
+// as long as the row needs. Tile i of the room, in the order of RoomGraph::getTiles, has mask
+// number tileMaskIds[tileBegins[r] + i].
+class TileVisibility
+{
+public:
+    // masks of one room and the mask of every tile of it
+    struct RoomMasks
+    {
+        std::vector<uint64_t> words;
+        std::vector<uint8_t> tileMaskIds;
+    };
+
+    TileVisibility() {}
+    TileVisibility(const TileVisibility&) = delete;
+    TileVisibility(TileVisibility&&) = default;
+    TileVisibility& operator=(const TileVisibility&) = delete;
+    TileVisibility& operator=(TileVisibility&&) = default;
+
+    static TileVisibility fromRooms(const std::vector<RoomMasks>& rooms);
+
+    // Replaces the masks of the ascending roomIds, the rooms keep their tile counts
+    void setRooms(const std::vector<unsigned>& roomIds, const std::vector<RoomMasks>& rooms);
+
+    unsigned getRoomCount() const;
+    size_t getBytes() const;
+
+    // Replaces the contents of row with the rooms of roomRow visible from tile tileIndex of
+    // the room, roomRow being the row of the room
+    void getRow(unsigned roomId, unsigned tileIndex, const std::vector<unsigned>& roomRow, std::vector<unsigned>& row) const;
+
+private:
+    std::vector<uint64_t> maskBegins = { 0 };
+    std::vector<uint64_t> words;
+
+    std::vector<unsigned> tileBegins = { 0 };
+    std::vector<uint8_t> tileMaskIds;
+};
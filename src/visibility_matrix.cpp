@@ -0,0 +1,357 @@
+#include "visibility_matrix.hpp"
+
+#include <algorithm>
+#include <assert.h>
+
+VisibilityMatrix VisibilityMatrix::fromRows(const std::vector<unsigned>& rowSizes, const std::vector<std::vector<unsigned>>& blocks, Layout layout)
+{
+    VisibilityMatrix matrix;
+    std::vector<uint64_t>& rowBegins = matrix.rowBegins.own();
+    std::vector<unsigned>& ids = matrix.ids.own();
+    std::vector<uint64_t>& bits = matrix.bits.own();
+    std::vector<uint64_t>& byteBegins = matrix.byteBegins.own();
+    std::vector<uint8_t>& bytes = matrix.bytes.own();
+
+    matrix.nRooms = rowSizes.size();
+    matrix.rowWords = (matrix.nRooms + 63) / 64;
+
+    std::vector<uint64_t> blockBegins(blocks.size() + 1, 0);
+    for (size_t i = 0; i < blocks.size(); i++)
+        blockBegins[i + 1] = blockBegins[i] + blocks[i].size();
+
+    matrix.nVisible = blockBegins.back();
+
+    rowBegins.resize(matrix.nRooms + 1);
+    for (unsigned i = 0; i < matrix.nRooms; i++)
+        rowBegins[i + 1] = rowBegins[i] + rowSizes[i];
+
+    assert(rowBegins.back() == matrix.nVisible);
+
+    ids.resize(matrix.nVisible);
+
+    #pragma omp parallel for schedule(static)
+    for (int i = 0; i < (int)blocks.size(); i++)
+        std::copy(blocks[i].begin(), blocks[i].end(), ids.begin() + blockBegins[i]);
+
+    matrix.layout = layout;
+    if (layout == Layout::Sparse)
+        return matrix;
+
+    size_t denseBytes = (size_t)matrix.nRooms * matrix.rowWords * sizeof(uint64_t);
+
+    if (layout != Layout::Dense)
+    {
+        // sizes of the encoded rows first, so every row can be encoded in place
+        byteBegins.assign(matrix.nRooms + 1, 0);
+
+        #pragma omp parallel for schedule(static)
+        for (int row = 0; row < (int)matrix.nRooms; row++)
+        {
+            uint64_t begin = rowBegins[row];
+            byteBegins[row + 1] = getEncodedBytes(row, ids.data() + begin, rowBegins[row + 1] - begin);
+        }
+
+        for (unsigned i = 0; i < matrix.nRooms; i++)
+            byteBegins[i + 1] += byteBegins[i];
+
+        size_t compressedBytes = byteBegins.size() * sizeof(uint64_t) + byteBegins.back();
+        matrix.layout = layout == Layout::Auto && denseBytes <= compressedBytes ? Layout::Dense : Layout::Compressed;
+    }
+
+    if (matrix.layout == Layout::Compressed)
+    {
+        bytes.resize(byteBegins.back());
+
+        #pragma omp parallel for schedule(static)
+        for (int row = 0; row < (int)matrix.nRooms; row++)
+        {
+            uint64_t begin = rowBegins[row];
+            uint8_t* out = encodeRow(bytes.data() + byteBegins[row], row, ids.data() + begin, rowBegins[row + 1] - begin);
+
+            assert(out == bytes.data() + byteBegins[row + 1]);
+        }
+
+        // compressed rows carry their sizes
+        rowBegins = {};
+        ids = {};
+
+        return matrix;
+    }
+
+    byteBegins = {};
+    bits.assign((size_t)matrix.nRooms * matrix.rowWords, 0ull);
+
+    #pragma omp parallel for schedule(static)
+    for (int row = 0; row < (int)matrix.nRooms; row++)
+    {
+        for (uint64_t i = rowBegins[row]; i < rowBegins[row + 1]; i++)
+            bits[(size_t)row * matrix.rowWords + ids[i] / 64] |= 1ull << (ids[i] % 64);
+    }
+
+    // dense rows keep the row table for their sizes only
+    ids = {};
+
+    return matrix;
+}
+
+VisibilityMatrix VisibilityMatrix::withLayout(Layout layout) const
+{
+    std::vector<unsigned> rowSizes(nRooms);
+    std::vector<std::vector<unsigned>> blocks(1);
+    blocks[0].reserve(nVisible);
+
+    for (unsigned roomId = 0; roomId < nRooms; roomId++)
+    {
+        rowSizes[roomId] = getRowSize(roomId);
+        forEachVisible(roomId, [&](unsigned visibleId) { blocks[0].push_back(visibleId); });
+    }
+
+    return fromRows(rowSizes, blocks, layout);
+}
+
+VisibilityMatrix VisibilityMatrix::fromRanges(const std::vector<VisibilityMatrix>& ranges, Layout layout)
+{
+    std::vector<unsigned> rowSizes;
+    std::vector<std::vector<unsigned>> blocks(ranges.size());
+
+    for (size_t i = 0; i < ranges.size(); i++)
+    {
+        blocks[i].reserve(ranges[i].nVisible);
+
+        for (unsigned row = 0; row < ranges[i].nRooms; row++)
+        {
+            rowSizes.push_back(ranges[i].getRowSize(row));
+            ranges[i].forEachVisible(row, [&](unsigned visibleId) { blocks[i].push_back(visibleId); });
+        }
+    }
+
+    return fromRows(rowSizes, blocks, layout);
+}
+
+unsigned VisibilityMatrix::getRoomCount() const
+{
+    return nRooms;
+}
+
+VisibilityMatrix::Layout VisibilityMatrix::getLayout() const
+{
+    return layout;
+}
+
+uint64_t VisibilityMatrix::getVisibleCount() const
+{
+    return nVisible;
+}
+
+unsigned VisibilityMatrix::getRowSize(unsigned roomId) const
+{
+    assert(roomId < nRooms);
+
+    if (layout == Layout::Compressed)
+    {
+        const uint8_t* in = bytes.data() + byteBegins[roomId];
+        return readVarint(in);
+    }
+
+    return rowBegins[roomId + 1] - rowBegins[roomId];
+}
+
+size_t VisibilityMatrix::getBytes() const
+{
+    return bits.size() * sizeof(uint64_t) + rowBegins.size() * sizeof(uint64_t) + ids.size() * sizeof(unsigned)
+        + byteBegins.size() * sizeof(uint64_t) + bytes.size();
+}
+
+bool VisibilityMatrix::isVisible(unsigned fromRoomId, unsigned toRoomId) const
+{
+    assert(fromRoomId < nRooms && toRoomId < nRooms);
+
+    if (layout == Layout::Dense)
+        return bits[(size_t)fromRoomId * rowWords + toRoomId / 64] & (1ull << (toRoomId % 64));
+
+    if (layout == Layout::Compressed)
+    {
+        // ids ascend, so the decode stops at the first one not below toRoomId
+        const uint8_t* in = bytes.data() + byteBegins[fromRoomId];
+        unsigned rowSize = readVarint(in);
+        if (rowSize == 0)
+            return false;
+
+        uint32_t zigzag = readVarint(in);
+        unsigned id = fromRoomId + ((int)(zigzag >> 1) ^ -(int)(zigzag & 1u));
+
+        for (unsigned i = 1; i < rowSize && id < toRoomId; i++)
+            id += readVarint(in) + 1;
+
+        return id == toRoomId;
+    }
+
+    auto rowBegin = ids.begin() + rowBegins[fromRoomId];
+    auto rowEnd = ids.begin() + rowBegins[fromRoomId + 1];
+
+    return std::binary_search(rowBegin, rowEnd, toRoomId);
+}
+
+void VisibilityMatrix::setRows(const std::vector<unsigned>& roomIds, const std::vector<std::vector<unsigned>>& rows)
+{
+    assert(roomIds.size() == rows.size() && std::is_sorted(roomIds.begin(), roomIds.end()));
+
+    for (unsigned i = 0; i < roomIds.size(); i++)
+        nVisible += rows[i].size() - getRowSize(roomIds[i]);
+
+    if (layout == Layout::Sparse)
+    {
+        spliceRows(rowBegins.own(), ids.own(), roomIds, rows);
+        return;
+    }
+
+    if (layout == Layout::Compressed)
+    {
+        std::vector<std::vector<uint8_t>> encodedRows(rows.size());
+        for (unsigned i = 0; i < rows.size(); i++)
+        {
+            encodedRows[i].resize(getEncodedBytes(roomIds[i], rows[i].data(), rows[i].size()));
+            encodeRow(encodedRows[i].data(), roomIds[i], rows[i].data(), rows[i].size());
+        }
+
+        spliceRows(byteBegins.own(), bytes.own(), roomIds, encodedRows);
+        return;
+    }
+
+    // dense rows are rewritten in place, only the row sizes move
+    std::vector<uint64_t> newRowBegins(nRooms + 1, 0);
+    for (unsigned roomId = 0, i = 0; roomId < nRooms; roomId++)
+    {
+        bool isSet = i < roomIds.size() && roomIds[i] == roomId;
+        newRowBegins[roomId + 1] = newRowBegins[roomId] + (isSet ? rows[i++].size() : getRowSize(roomId));
+    }
+    rowBegins = std::move(newRowBegins);
+
+    for (unsigned i = 0; i < roomIds.size(); i++)
+    {
+        uint64_t* row = &bits.own()[(size_t)roomIds[i] * rowWords];
+        std::fill(row, row + rowWords, 0ull);
+
+        for (unsigned id : rows[i])
+            row[id / 64] |= 1ull << (id % 64);
+    }
+}
+
+void VisibilityMatrix::getRow(unsigned roomId, std::vector<unsigned>& row) const
+{
+    assert(roomId < nRooms);
+
+    row.clear();
+    forEachVisible(roomId, [&](unsigned visibleId) { row.push_back(visibleId); });
+}
+
+bool VisibilityMatrix::operator==(const VisibilityMatrix& other) const
+{
+    if (nRooms != other.nRooms || nVisible != other.nVisible)
+        return false;
+
+    // the encoding of a row is unique, so the same layouts compare their storage
+    if (layout == other.layout)
+    {
+        switch (layout)
+        {
+        case Layout::Dense:
+            return rowBegins == other.rowBegins && bits == other.bits;
+        case Layout::Compressed:
+            return byteBegins == other.byteBegins && bytes == other.bytes;
+        default:
+            return rowBegins == other.rowBegins && ids == other.ids;
+        }
+    }
+
+    // layouts differ, compare the rows room by room
+    std::vector<unsigned> row, otherRow;
+    for (unsigned roomId = 0; roomId < nRooms; roomId++)
+    {
+        getRow(roomId, row);
+        other.getRow(roomId, otherRow);
+
+        if (row != otherRow)
+            return false;
+    }
+
+    return true;
+}
+
+template<typename T>
+void VisibilityMatrix::spliceRows(std::vector<uint64_t>& begins, std::vector<T>& data, const std::vector<unsigned>& roomIds, const std::vector<std::vector<T>>& rows)
+{
+    unsigned nRows = begins.size() - 1;
+
+    std::vector<uint64_t> newBegins(nRows + 1, 0);
+    for (unsigned row = 0, i = 0; row < nRows; row++)
+    {
+        bool isSet = i < roomIds.size() && roomIds[i] == row;
+        newBegins[row + 1] = newBegins[row] + (isSet ? rows[i++].size() : begins[row + 1] - begins[row]);
+    }
+
+    std::vector<T> newData(newBegins.back());
+    unsigned keptBegin = 0;
+    for (unsigned i = 0; i <= roomIds.size(); i++)
+    {
+        unsigned keptEnd = i < roomIds.size() ? roomIds[i] : nRows;
+        std::copy(data.begin() + begins[keptBegin], data.begin() + begins[keptEnd], newData.begin() + newBegins[keptBegin]);
+
+        if (i < roomIds.size())
+            std::copy(rows[i].begin(), rows[i].end(), newData.begin() + newBegins[roomIds[i]]);
+
+        keptBegin = keptEnd + 1;
+    }
+
+    begins = std::move(newBegins);
+    data = std::move(newData);
+}
+
+uint64_t VisibilityMatrix::getEncodedBytes(unsigned roomId, const unsigned* rowIds, uint64_t rowSize)
+{
+    uint64_t rowBytes = getVarintBytes(rowSize);
+    if (rowSize != 0)
+    {
+        int offset = (int)rowIds[0] - (int)roomId;
+        rowBytes += getVarintBytes(((uint32_t)offset << 1) ^ (uint32_t)(offset >> 31));
+    }
+
+    for (uint64_t i = 1; i < rowSize; i++)
+        rowBytes += getVarintBytes(rowIds[i] - rowIds[i - 1] - 1);
+
+    return rowBytes;
+}
+
+uint8_t* VisibilityMatrix::encodeRow(uint8_t* out, unsigned roomId, const unsigned* rowIds, uint64_t rowSize)
+{
+    out = writeVarint(out, rowSize);
+    if (rowSize != 0)
+    {
+        int offset = (int)rowIds[0] - (int)roomId;
+        out = writeVarint(out, ((uint32_t)offset << 1) ^ (uint32_t)(offset >> 31));
+    }
+
+    for (uint64_t i = 1; i < rowSize; i++)
+        out = writeVarint(out, rowIds[i] - rowIds[i - 1] - 1);
+
+    return out;
+}
+
+unsigned VisibilityMatrix::getVarintBytes(uint32_t value)
+{
+    unsigned nBytes = 1;
+    for (; value >= 0x80u; value >>= 7)
+        nBytes++;
+
+    return nBytes;
+}
+
+uint8_t* VisibilityMatrix::writeVarint(uint8_t* out, uint32_t value)
+{
+    for (; value >= 0x80u; value >>= 7)
+        *out++ = (uint8_t)(value | 0x80u);
+
+    *out++ = (uint8_t)value;
+
+    return out;
+}
@@ -0,0 +1,210 @@
+#pragma once
+
+#include <algorithm>
+#include <bit>
+#include <cstdint>
+#include <initializer_list>
+#include <memory>
+#include <string>
+#include <vector>
+
+class MappedFile;
+
+// Elements of a section of a matrix, owned or pointing into the file the matrix was loaded
+// from. A section is changed only through its owned elements, which copies a mapped section
+// out of the file first.
+template<typename T>
+class MatrixSection
+{
+public:
+    MatrixSection() {}
+    MatrixSection(std::initializer_list<T> elements) : owned(elements) {}
+    MatrixSection(std::vector<T>&& elements) : owned(std::move(elements)) {}
+
+    void map(const T* elements, size_t count)
+    {
+        owned = {};
+        mapped = elements;
+        nMapped = count;
+    }
+
+    std::vector<T>& own()
+    {
+        if (mapped != nullptr)
+        {
+            owned.assign(mapped, mapped + nMapped);
+            mapped = nullptr;
+        }
+
+        return owned;
+    }
+
+    const T* data() const { return mapped != nullptr ? mapped : owned.data(); }
+    size_t size() const { return mapped != nullptr ? nMapped : owned.size(); }
+    bool empty() const { return size() == 0; }
+    const T* begin() const { return data(); }
+    const T* end() const { return data() + size(); }
+    const T& front() const { return data()[0]; }
+    const T& back() const { return data()[size() - 1]; }
+    const T& operator[](size_t i) const { return data()[i]; }
+
+    bool operator==(const MatrixSection& other) const { return std::equal(begin(), end(), other.begin(), other.end()); }
+
+private:
+    std::vector<T> owned;
+    const T* mapped = nullptr;
+    size_t nMapped = 0;
+};
+
+// Rooms visible from every room. Rows are dense bitsets with one bit per room, sorted room
+// ids in compressed sparse row form or the sorted ids compressed. Row r of the sparse form is
+// ids[rowBegins[r], rowBegins[r + 1]).
+//
+// A compressed row is bytes[byteBegins[r], byteBegins[r + 1]), varints of the row size, the
+// zigzagged difference of the first id from r and the gaps between the following ids minus
+// one. Rooms are numbered in scan order, so visible rooms have ids close to each other.
+class VisibilityMatrix
+{
+public:
+    enum class Layout
+    {
+        // the smaller of dense and compressed
+        Auto,
+        Dense,
+        Sparse,
+        Compressed
+    };
+
+    VisibilityMatrix() {}
+    VisibilityMatrix(const VisibilityMatrix&) = delete;
+    VisibilityMatrix(VisibilityMatrix&&) = default;
+    VisibilityMatrix& operator=(const VisibilityMatrix&) = delete;
+    VisibilityMatrix& operator=(VisibilityMatrix&&) = default;
+
+    // Joins rows given as consecutive blocks, every block holds the sorted ids of its rows one
+    // after another and rowSizes has the size of every row
+    static VisibilityMatrix fromRows(const std::vector<unsigned>& rowSizes, const std::vector<std::vector<unsigned>>& blocks, Layout layout = Layout::Auto);
+
+    // Joins matrices holding consecutive ranges of the rows of one matrix, their rows being
+    // sparse or compressed
+    static VisibilityMatrix fromRanges(const std::vector<VisibilityMatrix>& ranges, Layout layout = Layout::Auto);
+
+    // Returns the matrix with its rows in another layout
+    VisibilityMatrix withLayout(Layout layout) const;
+
+    // Writes the rows in their layout in the format described in pvs_file.hpp, key names
+    // what they were computed for
+    bool save(const std::string& path, uint64_t key) const;
+    // Replaces the matrix with the one in the file, fails without changing it if the file
+    // is of another version or key or it is corrupted. The file stays mapped and the rows are
+    // read from it in place until they are changed.
+    bool load(const std::string& path, uint64_t key);
+
+    unsigned getRoomCount() const;
+    Layout getLayout() const;
+    // rooms visible from all rooms together
+    uint64_t getVisibleCount() const;
+    unsigned getRowSize(unsigned roomId) const;
+    size_t getBytes() const;
+
+    // O(1) in the dense layout, a binary search of the row in the sparse one and a decode of
+    // the row up to toRoomId in the compressed one. Auto weighs only the sizes, so a compressed
+    // matrix pays for the ids in front of toRoomId on every lookup, few as rows are mostly
+    // rooms numbered close to the room itself.
+    bool isVisible(unsigned fromRoomId, unsigned toRoomId) const;
+    // Replaces the contents of row with the rooms visible from roomId in ascending order
+    void getRow(unsigned roomId, std::vector<unsigned>& row) const;
+    // Replaces the rows of the ascending roomIds with the sorted rows, in time linear in the
+    // size of the matrix
+    void setRows(const std::vector<unsigned>& roomIds, const std::vector<std::vector<unsigned>>& rows);
+
+    // Calls visit with every room visible from roomId in ascending order
+    template<typename Visit>
+    void forEachVisible(unsigned roomId, Visit visit) const;
+
+    bool operator==(const VisibilityMatrix& other) const;
+
+private:
+    unsigned nRooms = 0;
+    uint64_t nVisible = 0;
+    Layout layout = Layout::Sparse;
+
+    // dense rows
+    unsigned rowWords = 0;
+    MatrixSection<uint64_t> bits;
+
+    // sparse rows, dense rows keep rowBegins for the row sizes
+    MatrixSection<uint64_t> rowBegins = { 0 };
+    MatrixSection<unsigned> ids;
+
+    // compressed rows
+    MatrixSection<uint64_t> byteBegins;
+    MatrixSection<uint8_t> bytes;
+
+    // file the mapped sections point into
+    std::shared_ptr<MappedFile> file;
+
+    // section sizes match the layout and the room count
+    bool hasValidSizes() const;
+
+    // Replaces the rows of begins and data with the rows of roomIds
+    template<typename T>
+    static void spliceRows(std::vector<uint64_t>& begins, std::vector<T>& data, const std::vector<unsigned>& roomIds, const std::vector<std::vector<T>>& rows);
+
+    static uint64_t getEncodedBytes(unsigned roomId, const unsigned* rowIds, uint64_t rowSize);
+    static uint8_t* encodeRow(uint8_t* out, unsigned roomId, const unsigned* rowIds, uint64_t rowSize);
+    static unsigned getVarintBytes(uint32_t value);
+    static uint8_t* writeVarint(uint8_t* out, uint32_t value);
+
+    static uint32_t readVarint(const uint8_t*& in)
+    {
+        uint32_t value = 0;
+        for (unsigned shift = 0; ; shift += 7)
+        {
+            uint8_t byte = *in++;
+            value |= (uint32_t)(byte & 0x7Fu) << shift;
+
+            if ((byte & 0x80u) == 0)
+                return value;
+        }
+    }
+};
+
+template<typename Visit>
+void VisibilityMatrix::forEachVisible(unsigned roomId, Visit visit) const
+{
+    if (layout == Layout::Sparse)
+    {
+        for (uint64_t i = rowBegins[roomId]; i < rowBegins[roomId + 1]; i++)
+            visit(ids[i]);
+
+        return;
+    }
+
+    if (layout == Layout::Compressed)
+    {
+        const uint8_t* in = bytes.data() + byteBegins[roomId];
+        unsigned rowSize = readVarint(in);
+        if (rowSize == 0)
+            return;
+
+        uint32_t zigzag = readVarint(in);
+        unsigned id = roomId + ((int)(zigzag >> 1) ^ -(int)(zigzag & 1u));
+        visit(id);
+
+        for (unsigned i = 1; i < rowSize; i++)
+        {
+            id += readVarint(in) + 1;
+            visit(id);
+        }
+
+        return;
+    }
+
+    const uint64_t* row = &bits[(size_t)roomId * rowWords];
+    for (unsigned word = 0; word < rowWords; word++)
+    {
+        for (uint64_t wordBits = row[word]; wordBits != 0; wordBits &= wordBits - 1)
+            visit(word * 64 + std::countr_zero(wordBits));
+    }
+}